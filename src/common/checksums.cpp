@@ -19,8 +19,20 @@
 #include "filesystembase.h"
 #include "common/checksums.h"
 
+#include <QFile>
+#include <QFutureInterface>
 #include <QLoggingCategory>
-#include <qtconcurrentrun.h>
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include <deque>
+#include <vector>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
 
 /** \file checksums.cpp
  *
@@ -154,11 +166,106 @@ static bool checksumComputationEnabled()
     return enabled;
 }
 
+namespace {
+
+/**
+ * Runs the asynchronous checksum computations.
+ *
+ * Uses a thread pool of its own so that hashing large files can't starve
+ * the global pool, and so the number of files read in parallel is bounded.
+ *
+ * Requests are queued and each worker keeps taking requests until the queue
+ * is empty. Many small files therefore don't cost a task each.
+ */
+class ChecksumQueue
+{
+public:
+    static ChecksumQueue *instance()
+    {
+        static ChecksumQueue queue;
+        return &queue;
+    }
+
+    QFuture<QMap<QByteArray, QByteArray>> enqueue(const QString &filePath, const QList<QByteArray> &checksumTypes)
+    {
+        Request request{ filePath, checksumTypes, QFutureInterface<QMap<QByteArray, QByteArray>>() };
+        request.result.reportStarted();
+        auto future = request.result.future();
+
+        QMutexLocker locker(&_mutex);
+        _requests.push_back(std::move(request));
+        if (_activeWorkers < _pool.maxThreadCount()) {
+            ++_activeWorkers;
+            _pool.start(new Worker(this));
+        }
+        return future;
+    }
+
+private:
+    ChecksumQueue()
+    {
+        // Reading the files is the bottleneck, more threads mostly add seeks
+        _pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), 4));
+    }
+
+    struct Request
+    {
+        QString filePath;
+        QList<QByteArray> checksumTypes;
+        QFutureInterface<QMap<QByteArray, QByteArray>> result;
+    };
+
+    class Worker : public QRunnable
+    {
+    public:
+        explicit Worker(ChecksumQueue *queue)
+            : _queue(queue)
+        {
+        }
+        void run() override { _queue->work(); }
+
+    private:
+        ChecksumQueue *_queue;
+    };
+
+    void work()
+    {
+        QMutexLocker locker(&_mutex);
+        while (!_requests.empty()) {
+            Request request = std::move(_requests.front());
+            _requests.pop_front();
+            locker.unlock();
+
+            // Skip requests whose ComputeChecksum is gone already
+            if (!request.result.isCanceled()) {
+                request.result.reportResult(ComputeChecksum::computeNow(request.filePath, request.checksumTypes));
+            }
+            request.result.reportFinished();
+
+            locker.relock();
+        }
+        --_activeWorkers;
+    }
+
+    QMutex _mutex;
+    std::deque<Request> _requests;
+    int _activeWorkers = 0;
+    QThreadPool _pool;
+};
+
+}
+
 ComputeChecksum::ComputeChecksum(QObject *parent)
     : QObject(parent)
 {
 }
 
+ComputeChecksum::~ComputeChecksum()
+{
+    // Nobody is interested in the result anymore
+    _watcher.cancel();
+}
+
 void ComputeChecksum::setChecksumType(const QByteArray &type)
 {
     _checksumType = type;
@@ -169,15 +276,72 @@ QByteArray ComputeChecksum::checksumType() const
     return _checksumType;
 }
 
+void ComputeChecksum::setAdditionalChecksumTypes(const QList<QByteArray> &types)
+{
+    _additionalChecksumTypes = types;
+}
+
 void ComputeChecksum::start(const QString &filePath)
 {
-    qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of" << filePath << "in a thread";
+    QList<QByteArray> types{ checksumType() };
+    for (const auto &type : _additionalChecksumTypes) {
+        if (!types.contains(type))
+            types.append(type);
+    }
+    qCInfo(lcChecksums) << "Computing" << types << "checksum of" << filePath << "in a thread";
 
     // Calculate the checksum in a different thread first.
     connect(&_watcher, &QFutureWatcherBase::finished,
         this, &ComputeChecksum::slotCalculationDone,
         Qt::UniqueConnection);
-    _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+    _watcher.setFuture(ChecksumQueue::instance()->enqueue(filePath, types));
+}
+
+ChecksumCalculator::ChecksumCalculator(const QByteArray &checksumType)
+    : _checksumType(checksumType)
+{
+    if (!checksumComputationEnabled())
+        return;
+
+    if (checksumType == checkSumMD5C) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Md5));
+    } else if (checksumType == checkSumSHA1C) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Sha1));
+    }
+#ifdef ZLIB_FOUND
+    else if (checksumType == checkSumAdlerC) {
+        _useAdler = true;
+        _adler = adler32(0L, Z_NULL, 0);
+    }
+#endif
+}
+
+ChecksumCalculator::~ChecksumCalculator() = default;
+
+bool ChecksumCalculator::isValid() const
+{
+    return _cryptoHash || _useAdler;
+}
+
+void ChecksumCalculator::addData(const char *data, qint64 length)
+{
+    if (_cryptoHash) {
+        _cryptoHash->addData(data, static_cast<int>(length));
+    }
+#ifdef ZLIB_FOUND
+    else if (_useAdler) {
+        _adler = adler32(_adler, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(length));
+    }
+#endif
+}
+
+QByteArray ChecksumCalculator::result() const
+{
+    if (_cryptoHash)
+        return _cryptoHash->result().toHex();
+    if (_useAdler)
+        return QByteArray::number(_adler, 16);
+    return QByteArray();
 }
 
 QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray &checksumType)
@@ -204,9 +368,56 @@ QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray
     return QByteArray();
 }
 
+QMap<QByteArray, QByteArray> ComputeChecksum::computeNow(const QString &filePath, const QList<QByteArray> &checksumTypes)
+{
+    QMap<QByteArray, QByteArray> checksums;
+    if (checksumTypes.size() <= 1) {
+        const auto type = checksumTypes.value(0);
+        const auto checksum = computeNow(filePath, type);
+        if (!checksum.isNull())
+            checksums.insert(type, checksum);
+        return checksums;
+    }
+
+    std::vector<std::unique_ptr<ChecksumCalculator>> calculators;
+    for (const auto &type : checksumTypes) {
+        std::unique_ptr<ChecksumCalculator> calculator(new ChecksumCalculator(type));
+        if (calculator->isValid()) {
+            calculators.push_back(std::move(calculator));
+        } else if (!type.isEmpty() && checksumComputationEnabled()) {
+            qCWarning(lcChecksums) << "Unknown checksum type:" << type;
+        }
+    }
+    if (calculators.empty())
+        return checksums;
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(lcChecksums) << "Could not open" << filePath << file.errorString();
+        return checksums;
+    }
+    // Same block size as the single type computations
+    QByteArray buf(qMin<qint64>(1024 * 1024, file.size() + 1), Qt::Uninitialized);
+    qint64 size;
+    while ((size = file.read(buf.data(), buf.size())) > 0) {
+        for (const auto &calculator : calculators)
+            calculator->addData(buf.constData(), size);
+    }
+    if (size < 0) {
+        qCWarning(lcChecksums) << "Could not read" << filePath << file.errorString();
+        return checksums;
+    }
+
+    for (const auto &calculator : calculators)
+        checksums.insert(calculator->checksumType(), calculator->result());
+    return checksums;
+}
+
 void ComputeChecksum::slotCalculationDone()
 {
-    QByteArray checksum = _watcher.future().result();
+    const auto checksums = _watcher.future().result();
+    emit checksumsComputed(checksums);
+    QByteArray checksum = checksums.value(_checksumType);
     if (!checksum.isNull()) {
         emit done(_checksumType, checksum);
     } else {
@@ -221,6 +432,12 @@ ValidateChecksumHeader::ValidateChecksumHeader(QObject *parent)
 }
 
 void ValidateChecksumHeader::start(const QString &filePath, const QByteArray &checksumHeader)
+{
+    start(filePath, checksumHeader, QMap<QByteArray, QByteArray>());
+}
+
+void ValidateChecksumHeader::start(const QString &filePath, const QByteArray &checksumHeader,
+    const QMap<QByteArray, QByteArray> &knownChecksums)
 {
     // If the incoming header is empty no validation can happen. Just continue.
     if (checksumHeader.isEmpty()) {
@@ -234,6 +451,12 @@ void ValidateChecksumHeader::start(const QString &filePath, const QByteArray &ch
         return;
     }
 
+    auto known = knownChecksums.constFind(_expectedChecksumType);
+    if (known != knownChecksums.constEnd()) {
+        slotChecksumCalculated(_expectedChecksumType, *known);
+        return;
+    }
+
     auto calculator = new ComputeChecksum(this);
     calculator->setChecksumType(_expectedChecksumType);
     connect(calculator, &ComputeChecksum::done,
@@ -22,7 +22,11 @@
 
 #include <QObject>
 #include <QByteArray>
+#include <QCryptographicHash>
 #include <QFutureWatcher>
+#include <QMap>
+
+#include <memory>
 
 namespace OCC {
 
@@ -62,6 +66,36 @@ OCSYNC_EXPORT bool uploadChecksumEnabled();
 OCSYNC_EXPORT QByteArray contentChecksumType();
 
 
+/**
+ * Computes a checksum incrementally from data fed to it piece by piece.
+ *
+ * Used to hash data while it is being transferred so the file does not
+ * need to be read again afterwards.
+ * \ingroup libsync
+ */
+class OCSYNC_EXPORT ChecksumCalculator
+{
+public:
+    explicit ChecksumCalculator(const QByteArray &checksumType);
+    ~ChecksumCalculator();
+
+    QByteArray checksumType() const { return _checksumType; }
+
+    /// False if the checksum type is unknown or computations are disabled
+    bool isValid() const;
+
+    void addData(const char *data, qint64 length);
+
+    /// The checksum of all data added so far, in the same format as ComputeChecksum
+    QByteArray result() const;
+
+private:
+    QByteArray _checksumType;
+    std::unique_ptr<QCryptographicHash> _cryptoHash;
+    bool _useAdler = false;
+    unsigned int _adler = 0;
+};
+
 /**
  * Computes the checksum of a file.
  * \ingroup libsync
@@ -71,6 +105,7 @@ class OCSYNC_EXPORT ComputeChecksum : public QObject
     Q_OBJECT
 public:
     explicit ComputeChecksum(QObject *parent = 0);
+    ~ComputeChecksum();
 
     /**
      * Sets the checksum type to be used. The default is empty.
@@ -79,6 +114,12 @@ public:
 
     QByteArray checksumType() const;
 
+    /**
+     * Checksum types that are computed in the same pass over the file as
+     * the main one, see checksumsComputed(). The default is empty.
+     */
+    void setAdditionalChecksumTypes(const QList<QByteArray> &types);
+
     /**
      * Computes the checksum for the given file path.
      *
@@ -91,17 +132,27 @@ public:
      */
     static QByteArray computeNow(const QString &filePath, const QByteArray &checksumType);
 
+    /**
+     * Computes checksums of several types synchronously, reading the file
+     * only once. Unknown types are left out of the result.
+     */
+    static QMap<QByteArray, QByteArray> computeNow(const QString &filePath, const QList<QByteArray> &checksumTypes);
+
 signals:
     void done(const QByteArray &checksumType, const QByteArray &checksum);
 
+    /// Emitted right before done() with the checksums of all types, by type
+    void checksumsComputed(const QMap<QByteArray, QByteArray> &checksums);
+
 private slots:
     void slotCalculationDone();
 
 private:
     QByteArray _checksumType;
+    QList<QByteArray> _additionalChecksumTypes;
 
     // watcher for the checksum calculation thread
-    QFutureWatcher<QByteArray> _watcher;
+    QFutureWatcher<QMap<QByteArray, QByteArray>> _watcher;
 };
 
 /**
@@ -123,6 +174,13 @@ public:
      */
     void start(const QString &filePath, const QByteArray &checksumHeader);
 
+    /**
+     * Same as above, but if \a knownChecksums already holds a checksum of the
+     * header's type (by type name), it is compared directly and the file is not read.
+     */
+    void start(const QString &filePath, const QByteArray &checksumHeader,
+        const QMap<QByteArray, QByteArray> &knownChecksums);
+
 signals:
     void validated(const QByteArray &checksumType, const QByteArray &checksum);
     void validationFailed(const QString &errMsg);
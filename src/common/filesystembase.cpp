@@ -361,21 +361,28 @@ QString FileSystem::fileSystemForPath(const QString &path)
 }
 #endif
 
-#define BUFSIZE qint64(500 * 1024) // 500 KiB
+#define BUFSIZE qint64(1024 * 1024) // 1 MiB
 
+// QCryptographicHash::addData(QIODevice*) reads in 1 KiB pieces through QFile's
+// own buffer. Read big blocks directly instead.
 static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Algorithm algo )
- {
-     QFile file(filename);
-     QByteArray arr;
-     QCryptographicHash crypto( algo );
-
-     if (file.open(QIODevice::ReadOnly)) {
-         if (crypto.addData(&file)) {
-             arr = crypto.result().toHex();
-         }
-     }
-     return arr;
- }
+{
+    QFile file(filename);
+    QCryptographicHash crypto( algo );
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return QByteArray();
+
+    const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
+    QByteArray buf(bufSize, Qt::Uninitialized);
+    qint64 size;
+    while ((size = file.read(buf.data(), bufSize)) > 0)
+        crypto.addData(buf.constData(), static_cast<int>(size));
+    if (size < 0)
+        return QByteArray();
+
+    return crypto.result().toHex();
+}
 
 QByteArray FileSystem::calcMd5(const QString &filename)
 {
@@ -395,13 +402,10 @@ QByteArray FileSystem::calcAdler32(const QString &filename)
     QByteArray buf(bufSize, Qt::Uninitialized);
 
     unsigned int adler = adler32(0L, Z_NULL, 0);
-    if (file.open(QIODevice::ReadOnly)) {
+    if (file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
         qint64 size;
-        while (!file.atEnd()) {
-            size = file.read(buf.data(), bufSize);
-            if (size > 0)
-                adler = adler32(adler, (const Bytef *)buf.data(), size);
-        }
+        while ((size = file.read(buf.data(), bufSize)) > 0)
+            adler = adler32(adler, (const Bytef *)buf.data(), size);
     }
 
     return QByteArray::number(adler, 16);
@@ -24,6 +24,7 @@
 #include <QUrl>
 #include <QDir>
 #include <QStandardPaths>
+#include <QThread>
 #include <sqlite3.h>
 
 #include "common/syncjournaldb.h"
@@ -94,6 +95,7 @@ SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     , _mutex(QMutex::Recursive)
     , _transaction(0)
     , _metadataTableIsEmpty(false)
+    , _readConnectionThread(nullptr)
 {
     // Allow forcing the journal mode for debugging
     static QByteArray envJournalMode = qgetenv("OWNCLOUD_SQLITE_JOURNAL_MODE");
@@ -252,6 +254,7 @@ void SyncJournalDb::startTransaction()
             return;
         }
         _transaction = 1;
+        _transactionTimer.start();
     } else {
         qCDebug(lcDb) << "Database Transaction is running, not starting another one!";
     }
@@ -279,15 +282,50 @@ bool SyncJournalDb::sqlFail(const QString &log, const SqlQuery &query)
     return false;
 }
 
+/* Every lookup goes through checkConnect(). Checking for the file on each of them
+ * costs a stat() per call, which adds up quickly during discovery.
+ */
+static const qint64 dbFileCheckIntervalMs = 1000;
+
+/* A second connection to the same file that is only used for reading.
+ *
+ * The prepared statements mirror the ones of the main connection.
+ */
+struct SyncJournalDb::ReadConnection
+{
+    SqlDatabase db;
+    SqlQuery getFileRecordQuery;
+    SqlQuery getFileRecordQueryByMangledName;
+    SqlQuery getFileRecordQueryByInode;
+    SqlQuery getFileRecordQueryByFileId;
+    SqlQuery getFilesBelowPathQuery;
+    SqlQuery getAllFilesQuery;
+
+    /* A statement that was stepped but not reset keeps its read transaction,
+     * and with it the WAL snapshot, alive. That prevents checkpoints.
+     */
+    void resetQueries()
+    {
+        for (auto query : { &getFileRecordQuery, &getFileRecordQueryByMangledName,
+                 &getFileRecordQueryByInode, &getFileRecordQueryByFileId,
+                 &getFilesBelowPathQuery, &getAllFilesQuery }) {
+            query->reset_and_clear_bindings();
+        }
+    }
+};
+
 bool SyncJournalDb::checkConnect()
 {
     if (_db.isOpen()) {
         // Unfortunately the sqlite isOpen check can return true even when the underlying storage
         // has become unavailable - and then some operations may cause crashes. See #6049
-        if (!QFile::exists(_dbFile)) {
-            qCWarning(lcDb) << "Database open, but file " + _dbFile + " does not exist";
-            close();
-            return false;
+        if (!_dbFileCheckTimer.isValid() || _dbFileCheckTimer.hasExpired(dbFileCheckIntervalMs)) {
+            if (!QFile::exists(_dbFile)) {
+                qCWarning(lcDb) << "Database open, but file " + _dbFile + " does not exist";
+                close();
+                return false;
+            }
+            _dbFileCheckTimer.start();
         }
         return true;
     }
@@ -400,6 +438,7 @@ bool SyncJournalDb::checkConnect()
                         "tmpfile VARCHAR(4096),"
                         "etag VARCHAR(32),"
                         "errorcount INTEGER,"
+                        "ranges TEXT,"
                         "PRIMARY KEY(path)"
                         ");");
 
@@ -606,10 +645,92 @@ void SyncJournalDb::close()
     commitTransaction();
 
     _db.close();
+    _dbFileCheckTimer.invalidate();
+    _checksumTypeIds.clear();
+    dropMetadataSnapshot();
+    // A read connection that is in use is closed once its owner releases it
+    if (!_readConnectionThread.load())
+        _readConnection.reset();
     clearEtagStorageFilter();
     _metadataTableIsEmpty = false;
 }
 
+bool SyncJournalDb::openReadConnectionForCurrentThread()
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect())
+        return false;
+
+    // With other journal modes a reader would block the writers and vice versa
+    if (_journalMode != "WAL")
+        return false;
+
+    // Make what was written so far visible to the read connection
+    commitInternal(QStringLiteral("open read connection"));
+
+    if (!_readConnection)
+        _readConnection.reset(new ReadConnection);
+    if (!_readConnection->db.isOpen() && !_readConnection->db.openReadOnly(_dbFile)) {
+        qCWarning(lcDb) << "Could not open read connection:" << _readConnection->db.error();
+        _readConnection.reset();
+        return false;
+    }
+
+    _readConnectionThread.store(QThread::currentThread());
+    return true;
+}
+
+void SyncJournalDb::releaseReadConnection()
+{
+    QMutexLocker locker(&_mutex);
+    _readConnectionThread.store(nullptr);
+    if (!_db.isOpen())
+        _readConnection.reset();
+    else if (_readConnection)
+        _readConnection->resetQueries();
+}
+
+bool SyncJournalDb::loadMetadataSnapshot()
+{
+    // Hold the lock so no write can slip in between reading the table and
+    // installing the snapshot
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect())
+        return false;
+
+    std::unique_ptr<QHash<QByteArray, SyncJournalFileRecord>> snapshot(new QHash<QByteArray, SyncJournalFileRecord>);
+    if (!_metadataTableIsEmpty) {
+        const int count = getFileRecordCount();
+        if (count > 0)
+            snapshot->reserve(count);
+        bool ok = getFilesBelowPath(QByteArray(), [&](const SyncJournalFileRecord &rec) {
+            snapshot->insert(rec._path, rec);
+        });
+        if (!ok)
+            return false;
+    }
+
+    qCInfo(lcDb) << "Loaded metadata snapshot with" << snapshot->size() << "entries";
+    QMutexLocker snapshotLocker(&_snapshotMutex);
+    _metadataSnapshot = std::move(snapshot);
+    return true;
+}
+
+void SyncJournalDb::dropMetadataSnapshot()
+{
+    QMutexLocker snapshotLocker(&_snapshotMutex);
+    _metadataSnapshot.reset();
+}
+
+SyncJournalDb::ReadConnection *SyncJournalDb::currentReadConnection() const
+{
+    if (_readConnectionThread.load() == QThread::currentThread())
+        return _readConnection.get();
+    return nullptr;
+}
+
 
 bool SyncJournalDb::updateDatabaseStructure()
 {
@@ -724,6 +845,16 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add e2eMangledName col");
     }
 
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_e2e_id ON metadata(e2eMangledName);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index e2eMangledName", query);
+            re = false;
+        }
+        commitInternal("update database structure: add e2eMangledName index");
+    }
+
     if (!tableColumns("uploadinfo").contains("contentChecksum")) {
         SqlQuery query(_db);
         query.prepare("ALTER TABLE uploadinfo ADD COLUMN contentChecksum TEXT;");
@@ -734,6 +865,16 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add contentChecksum col for uploadinfo");
     }
 
+    if (!tableColumns("downloadinfo").contains("ranges")) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE downloadinfo ADD COLUMN ranges TEXT;");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: add ranges column", query);
+            re = false;
+        }
+        commitInternal("update database structure: add ranges col for downloadinfo");
+    }
+
 
     return re;
 }
@@ -892,6 +1033,10 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
         // Can't be true anymore.
         _metadataTableIsEmpty = false;
 
+        QMutexLocker snapshotLocker(&_snapshotMutex);
+        if (_metadataSnapshot)
+            _metadataSnapshot->insert(record._path, record);
+
         return true;
     } else {
         qCWarning(lcDb) << "Failed to connect database.";
@@ -916,6 +1061,11 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
         if (!_deleteFileRecordPhash.exec())
             return false;
 
+        QMutexLocker snapshotLocker(&_snapshotMutex);
+        if (_metadataSnapshot)
+            _metadataSnapshot->remove(filename.toUtf8());
+        snapshotLocker.unlock();
+
         if (recursively) {
             if (!_deleteFileRecordRecursively.initOrReset(QByteArrayLiteral("DELETE FROM metadata WHERE " IS_PREFIX_PATH_OF("?1", "path")), _db))
                 return false;
@@ -923,6 +1073,17 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
             if (!_deleteFileRecordRecursively.exec()) {
                 return false;
             }
+
+            snapshotLocker.relock();
+            if (_metadataSnapshot) {
+                const QByteArray prefix = filename.toUtf8() + '/';
+                for (auto it = _metadataSnapshot->begin(); it != _metadataSnapshot->end();) {
+                    if (it.key().startsWith(prefix))
+                        it = _metadataSnapshot->erase(it);
+                    else
+                        ++it;
+                }
+            }
         }
         return true;
     } else {
@@ -934,7 +1095,8 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 
 bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
+    auto readConnection = currentReadConnection();
+    QMutexLocker locker(readConnection ? nullptr : &_mutex);
 
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
@@ -944,28 +1106,42 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
-    if (!checkConnect())
+    {
+        QMutexLocker snapshotLocker(&_snapshotMutex);
+        if (_metadataSnapshot) {
+            auto it = _metadataSnapshot->constFind(filename);
+            if (it != _metadataSnapshot->constEnd())
+                *rec = *it;
+            return true;
+        }
+    }
+
+    if (!readConnection && !checkConnect())
         return false;
 
     if (!filename.isEmpty()) {
-        if (!_getFileRecordQuery.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), _db))
+        auto &db = readConnection ? readConnection->db : _db;
+        auto &query = readConnection ? readConnection->getFileRecordQuery : _getFileRecordQuery;
+        if (!query.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), db))
             return false;
 
-        _getFileRecordQuery.bindValue(1, getPHash(filename));
+        query.bindValue(1, getPHash(filename));
 
-        if (!_getFileRecordQuery.exec()) {
-            close();
+        if (!query.exec()) {
+            if (!readConnection)
+                close();
             return false;
         }
 
-        if (_getFileRecordQuery.next()) {
-            fillFileRecordFromGetQuery(*rec, _getFileRecordQuery);
+        if (query.next()) {
+            fillFileRecordFromGetQuery(*rec, query);
         } else {
-            int errId = _getFileRecordQuery.errorId();
+            int errId = query.errorId();
             if (errId != SQLITE_DONE) { // only do this if the problem is different from SQLITE_DONE
-                QString err = _getFileRecordQuery.error();
+                QString err = query.error();
                 qCWarning(lcDb) << "No journal entry found for " << filename << "Error: " << err;
-                close();
+                if (!readConnection)
+                    close();
             }
         }
     }
@@ -974,7 +1150,8 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
 
 bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
+    auto readConnection = currentReadConnection();
+    QMutexLocker locker(readConnection ? nullptr : &_mutex);
 
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
@@ -985,30 +1162,36 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
         return true; // no error, yet nothing found (rec->isValid() == false)
     }
 
-    if (!checkConnect()) {
+    if (!readConnection && !checkConnect()) {
         return false;
     }
 
     if (!mangledName.isEmpty()) {
-        if (!_getFileRecordQueryByMangledName.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE e2eMangledName=?1"), _db)) {
+        auto &db = readConnection ? readConnection->db : _db;
+        auto &query = readConnection ? readConnection->getFileRecordQueryByMangledName : _getFileRecordQueryByMangledName;
+        if (!query.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE e2eMangledName=?1"), db)) {
             return false;
         }
 
-        _getFileRecordQueryByMangledName.bindValue(1, mangledName);
+        query.bindValue(1, mangledName);
 
-        if (!_getFileRecordQueryByMangledName.exec()) {
-            close();
+        if (!query.exec()) {
+            if (!readConnection) {
+                close();
+            }
             return false;
         }
 
-        if (_getFileRecordQueryByMangledName.next()) {
-            fillFileRecordFromGetQuery(*rec, _getFileRecordQueryByMangledName);
+        if (query.next()) {
+            fillFileRecordFromGetQuery(*rec, query);
         } else {
-            int errId = _getFileRecordQueryByMangledName.errorId();
+            int errId = query.errorId();
             if (errId != SQLITE_DONE) { // only do this if the problem is different from SQLITE_DONE
-                QString err = _getFileRecordQueryByMangledName.error();
+                QString err = query.error();
                 qCWarning(lcDb) << "No journal entry found for mangled name" << mangledName << "Error: " << err;
-                close();
+                if (!readConnection) {
+                    close();
+                }
             }
         }
     }
@@ -1017,7 +1200,8 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
 
 bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
+    auto readConnection = currentReadConnection();
+    QMutexLocker locker(readConnection ? nullptr : &_mutex);
 
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
@@ -1027,44 +1211,49 @@ bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *r
     if (!inode || _metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
-    if (!checkConnect())
+    if (!readConnection && !checkConnect())
         return false;
 
-    if (!_getFileRecordQueryByInode.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"), _db))
+    auto &db = readConnection ? readConnection->db : _db;
+    auto &query = readConnection ? readConnection->getFileRecordQueryByInode : _getFileRecordQueryByInode;
+    if (!query.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"), db))
         return false;
 
-    _getFileRecordQueryByInode.bindValue(1, inode);
+    query.bindValue(1, inode);
 
-    if (!_getFileRecordQueryByInode.exec())
+    if (!query.exec())
         return false;
 
-    if (_getFileRecordQueryByInode.next())
-        fillFileRecordFromGetQuery(*rec, _getFileRecordQueryByInode);
+    if (query.next())
+        fillFileRecordFromGetQuery(*rec, query);
 
     return true;
 }
 
 bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
 {
-    QMutexLocker locker(&_mutex);
+    auto readConnection = currentReadConnection();
+    QMutexLocker locker(readConnection ? nullptr : &_mutex);
 
     if (fileId.isEmpty() || _metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
-    if (!checkConnect())
+    if (!readConnection && !checkConnect())
         return false;
 
-    if (!_getFileRecordQueryByFileId.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"), _db))
+    auto &db = readConnection ? readConnection->db : _db;
+    auto &query = readConnection ? readConnection->getFileRecordQueryByFileId : _getFileRecordQueryByFileId;
+    if (!query.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"), db))
         return false;
 
-    _getFileRecordQueryByFileId.bindValue(1, fileId);
+    query.bindValue(1, fileId);
 
-    if (!_getFileRecordQueryByFileId.exec())
+    if (!query.exec())
         return false;
 
-    while (_getFileRecordQueryByFileId.next()) {
+    while (query.next()) {
         SyncJournalFileRecord rec;
-        fillFileRecordFromGetQuery(rec, _getFileRecordQueryByFileId);
+        fillFileRecordFromGetQuery(rec, query);
         rowCallback(rec);
     }
 
@@ -1073,14 +1262,17 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
 
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
-    QMutexLocker locker(&_mutex);
+    auto readConnection = currentReadConnection();
+    QMutexLocker locker(readConnection ? nullptr : &_mutex);
 
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found
 
-    if (!checkConnect())
+    if (!readConnection && !checkConnect())
         return false;
 
+    auto &db = readConnection ? readConnection->db : _db;
+
     SqlQuery *query = nullptr;
 
     if(path.isEmpty()) {
@@ -1089,13 +1281,14 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
         // and find nothing. So, unfortunately, we have to use a different query for
         // retrieving the whole tree.
 
-        if (!_getAllFilesQuery.initOrReset(QByteArrayLiteral( GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"), _db))
+        query = readConnection ? &readConnection->getAllFilesQuery : &_getAllFilesQuery;
+        if (!query->initOrReset(QByteArrayLiteral( GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"), db))
             return false;
-        query = &_getAllFilesQuery;
     } else {
         // This query is used to skip discovery and fill the tree from the
         // database instead
-        if (!_getFilesBelowPathQuery.initOrReset(QByteArrayLiteral(
+        query = readConnection ? &readConnection->getFilesBelowPathQuery : &_getFilesBelowPathQuery;
+        if (!query->initOrReset(QByteArrayLiteral(
                 GET_FILE_RECORD_QUERY
                 " WHERE " IS_PREFIX_PATH_OF("?1", "path")
                 // We want to ensure that the contents of a directory are sorted
@@ -1103,10 +1296,9 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
                 // an ordering like foo, foo-2, foo/file would be returned.
                 // With the trailing /, we get foo-2, foo, foo/file. This property
                 // is used in fill_tree_from_db().
-                " ORDER BY path||'/' ASC"), _db)) {
+                " ORDER BY path||'/' ASC"), db)) {
             return false;
         }
-        query = &_getFilesBelowPathQuery;
         query->bindValue(1, path);
     }
 
@@ -1158,6 +1350,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
     }
 
     if (superfluousItems.count()) {
+        dropMetadataSnapshot();
         QByteArray sql = "DELETE FROM metadata WHERE phash in (" + superfluousItems.join(",") + ")";
         qCInfo(lcDb) << "Sync Journal cleanup for" << superfluousItems;
         SqlQuery delQuery(_db);
@@ -1217,7 +1410,16 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
     _setFileRecordChecksumQuery.bindValue(1, phash);
     _setFileRecordChecksumQuery.bindValue(2, contentChecksum);
     _setFileRecordChecksumQuery.bindValue(3, checksumTypeId);
-    return _setFileRecordChecksumQuery.exec();
+    if (!_setFileRecordChecksumQuery.exec())
+        return false;
+
+    QMutexLocker snapshotLocker(&_snapshotMutex);
+    if (_metadataSnapshot) {
+        auto it = _metadataSnapshot->find(filename.toUtf8());
+        if (it != _metadataSnapshot->end())
+            it->_checksumHeader = makeChecksumHeader(contentChecksumType, contentChecksum);
+    }
+    return true;
 }
 
 bool SyncJournalDb::updateLocalMetadata(const QString &filename,
@@ -1246,7 +1448,19 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     _setFileRecordLocalMetadataQuery.bindValue(2, inode);
     _setFileRecordLocalMetadataQuery.bindValue(3, modtime);
     _setFileRecordLocalMetadataQuery.bindValue(4, size);
-    return _setFileRecordLocalMetadataQuery.exec();
+    if (!_setFileRecordLocalMetadataQuery.exec())
+        return false;
+
+    QMutexLocker snapshotLocker(&_snapshotMutex);
+    if (_metadataSnapshot) {
+        auto it = _metadataSnapshot->find(filename.toUtf8());
+        if (it != _metadataSnapshot->end()) {
+            it->_inode = inode;
+            it->_modtime = modtime;
+            it->_fileSize = size;
+        }
+    }
+    return true;
 }
 
 bool SyncJournalDb::setFileRecordMetadata(const SyncJournalFileRecord &record)
@@ -1273,12 +1487,46 @@ bool SyncJournalDb::setFileRecordMetadata(const SyncJournalFileRecord &record)
     return setFileRecord(existing);
 }
 
+// The ranges are stored as "start-end,start-end,..."
+static QByteArray downloadRangesToString(const QVector<QPair<quint64, quint64>> &ranges)
+{
+    QByteArray result;
+    for (const auto &range : ranges) {
+        if (!result.isEmpty())
+            result += ',';
+        result += QByteArray::number(range.first) + '-' + QByteArray::number(range.second);
+    }
+    return result;
+}
+
+static QVector<QPair<quint64, quint64>> downloadRangesFromString(const QByteArray &str)
+{
+    QVector<QPair<quint64, quint64>> ranges;
+    for (const auto &part : str.split(',')) {
+        const int dash = part.indexOf('-');
+        if (dash <= 0)
+            continue;
+        bool okStart = false;
+        bool okEnd = false;
+        const quint64 start = part.left(dash).toULongLong(&okStart);
+        const quint64 end = part.mid(dash + 1).toULongLong(&okEnd);
+        if (!okStart || !okEnd || start > end) {
+            // Better download the file again than trust a broken entry
+            qCWarning(lcDb) << "Ignoring invalid download ranges" << str;
+            return {};
+        }
+        ranges.append(qMakePair(start, end));
+    }
+    return ranges;
+}
+
 static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo *res)
 {
     bool ok = true;
     res->_tmpfile = query.stringValue(0);
     res->_etag = query.baValue(1);
     res->_errorCount = query.intValue(2);
+    res->_ranges = downloadRangesFromString(query.baValue(3));
     res->_valid = ok;
 }
 
@@ -1309,7 +1557,7 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
     if (checkConnect()) {
 
         if (!_getDownloadInfoQuery.initOrReset(QByteArrayLiteral(
-                "SELECT tmpfile, etag, errorcount FROM downloadinfo WHERE path=?1"), _db)) {
+                "SELECT tmpfile, etag, errorcount, ranges FROM downloadinfo WHERE path=?1"), _db)) {
             return res;
         }
 
@@ -1340,14 +1588,15 @@ void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::Do
     if (i._valid) {
         if (!_setDownloadInfoQuery.initOrReset(QByteArrayLiteral(
                 "INSERT OR REPLACE INTO downloadinfo "
-                "(path, tmpfile, etag, errorcount) "
-                "VALUES ( ?1 , ?2, ?3, ?4 )"), _db)) {
+                "(path, tmpfile, etag, errorcount, ranges) "
+                "VALUES ( ?1 , ?2, ?3, ?4, ?5 )"), _db)) {
             return;
         }
         _setDownloadInfoQuery.bindValue(1, file);
         _setDownloadInfoQuery.bindValue(2, i._tmpfile);
         _setDownloadInfoQuery.bindValue(3, i._etag);
         _setDownloadInfoQuery.bindValue(4, i._errorCount);
+        _setDownloadInfoQuery.bindValue(5, downloadRangesToString(i._ranges));
         _setDownloadInfoQuery.exec();
     } else {
         _deleteDownloadInfoQuery.reset_and_clear_bindings();
@@ -1367,7 +1616,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    query.prepare("SELECT tmpfile, etag, errorcount, ranges, path FROM downloadinfo");
 
     if (!query.exec()) {
         return empty_result;
@@ -1377,7 +1626,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
 
     while (query.next()) {
-        const QString file = query.stringValue(3); // path
+        const QString file = query.stringValue(4); // path
         if (!keep.contains(file)) {
             superfluousPaths.append(file);
             DownloadInfo info;
@@ -1787,6 +2036,8 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
         return;
     }
 
+    dropMetadataSnapshot();
+
     SqlQuery query(_db);
     query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE " IS_PREFIX_PATH_OR_EQUAL("?1", "path"));
     query.bindValue(1, path);
@@ -1810,6 +2061,8 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QByteArray &fileName)
     if (argument.endsWith('/'))
         argument.chop(1);
 
+    dropMetadataSnapshot();
+
     SqlQuery query(_db);
     // This query will match entries for which the path is a prefix of fileName
     // Note: CSYNC_FTW_TYPE_DIR == 2
@@ -1842,6 +2095,7 @@ void SyncJournalDb::forceRemoteDiscoveryNextSync()
 void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
 {
     qCInfo(lcDb) << "Forcing remote re-discovery by deleting folder Etags";
+    dropMetadataSnapshot();
     SqlQuery deleteRemoteFolderEtagsQuery(_db);
     deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
     deleteRemoteFolderEtagsQuery.exec();
@@ -1877,6 +2131,10 @@ int SyncJournalDb::mapChecksumType(const QByteArray &checksumType)
         return 0;
     }
 
+    auto cached = _checksumTypeIds.constFind(checksumType);
+    if (cached != _checksumTypeIds.constEnd())
+        return *cached;
+
     // Ensure the checksum type is in the db
     if (!_insertChecksumTypeQuery.initOrReset(QByteArrayLiteral("INSERT OR IGNORE INTO checksumtype (name) VALUES (?1)"), _db))
         return 0;
@@ -1897,7 +2155,9 @@ int SyncJournalDb::mapChecksumType(const QByteArray &checksumType)
         qCWarning(lcDb) << "No checksum type mapping found for" << checksumType;
         return 0;
     }
-    return _getChecksumTypeIdQuery.intValue(0);
+    const int id = _getChecksumTypeIdQuery.intValue(0);
+    _checksumTypeIds.insert(checksumType, id);
+    return id;
 }
 
 QByteArray SyncJournalDb::dataFingerprint()
@@ -2009,6 +2269,7 @@ QByteArrayList SyncJournalDb::conflictRecordPaths()
 void SyncJournalDb::clearFileTable()
 {
     QMutexLocker lock(&_mutex);
+    dropMetadataSnapshot();
     SqlQuery query(_db);
     query.prepare("DELETE FROM metadata;");
     query.exec();
@@ -2031,6 +2292,14 @@ void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 }
 
 
+void SyncJournalDb::commitPeriodically(const QString &context)
+{
+    QMutexLocker lock(&_mutex);
+    if (_transaction == 1 && _transactionTimer.isValid() && _transactionTimer.elapsed() < 1000)
+        return;
+    commitInternal(context, true);
+}
+
 void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
 {
     qCDebug(lcDb) << "Transaction commit " << context << (startTrans ? "and starting new transaction" : "");
@@ -2058,6 +2327,7 @@ bool operator==(const SyncJournalDb::DownloadInfo &lhs,
     return lhs._errorCount == rhs._errorCount
         && lhs._etag == rhs._etag
         && lhs._tmpfile == rhs._tmpfile
+        && lhs._ranges == rhs._ranges
         && lhs._valid == rhs._valid;
 }
 
@@ -23,7 +23,10 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QElapsedTimer>
+#include <atomic>
 #include <functional>
+#include <memory>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -95,6 +98,13 @@ public:
         QByteArray _etag;
         int _errorCount;
         bool _valid;
+
+        /**
+         * For files downloaded with several ranged requests: the
+         * (next offset to download, end offset) of each range.
+         * Empty when the file is downloaded in one piece.
+         */
+        QVector<QPair<quint64, quint64>> _ranges;
     };
     struct UploadInfo
     {
@@ -206,6 +216,15 @@ public:
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /**
+     * Like commit(), but only commits if the running transaction is older
+     * than a second. Only for changes whose loss in a crash the next sync
+     * recovers from, like download progress or the record of a remote
+     * removal. Records of files that were just installed or uploaded must
+     * be committed right away.
+     */
+    void commitPeriodically(const QString &context);
+
     void close();
 
     /**
@@ -213,6 +232,45 @@ public:
      */
     bool isConnected();
 
+    /**
+     * Give the calling thread a read-only connection of its own.
+     *
+     * Until releaseReadConnection() is called, the record lookups
+     * (getFileRecord(), getFileRecordByInode(), getFileRecordsByFileId(),
+     * getFileRecordByE2eMangledName() and getFilesBelowPath()) done from that
+     * thread go through this connection and don't take the mutex, so they
+     * don't contend with the writes done from other threads.
+     *
+     * Only available when the journal is in WAL mode, where readers never
+     * block writers. Pending writes are committed first so they are visible
+     * to the new reader. Returns false if the connection can't be used; the
+     * lookups then continue to use the shared connection.
+     */
+    bool openReadConnectionForCurrentThread();
+
+    /**
+     * Stop routing lookups to the read connection.
+     *
+     * The connection itself stays open so the next sync can reuse it.
+     */
+    void releaseReadConnection();
+
+    /**
+     * Load the whole metadata table into memory.
+     *
+     * Until dropMetadataSnapshot() is called, getFileRecord() is answered from
+     * memory instead of issuing a query per path. Record writes done meanwhile
+     * are applied to the snapshot too; writes that touch many rows at once
+     * simply drop it.
+     */
+    bool loadMetadataSnapshot();
+    void dropMetadataSnapshot();
+
+    /**
+     * Number of entries in the metadata table, -1 on error.
+     */
+    int getFileRecordCount();
+
     /**
      * Returns the checksum type for an id.
      */
@@ -248,7 +306,6 @@ public:
     void clearFileTable();
 
 private:
-    int getFileRecordCount();
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
@@ -259,6 +316,10 @@ private:
     QVector<QByteArray> tableColumns(const QByteArray &table);
     bool checkConnect();
 
+    struct ReadConnection;
+    // The read connection if the calling thread owns it, nullptr otherwise
+    ReadConnection *currentReadConnection() const;
+
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
 
@@ -271,7 +332,23 @@ private:
     QString _dbFile;
     QMutex _mutex; // Public functions are protected with the mutex.
     int _transaction;
-    bool _metadataTableIsEmpty;
+    std::atomic<bool> _metadataTableIsEmpty;
+
+    // Limits how often checkConnect() verifies that the db file still exists
+    QElapsedTimer _dbFileCheckTimer;
+    // Age of the running transaction, see commitPeriodically()
+    QElapsedTimer _transactionTimer;
+
+    // Ids of the rows in the checksumtype table, see mapChecksumType()
+    QHash<QByteArray, int> _checksumTypeIds;
+
+    std::unique_ptr<ReadConnection> _readConnection;
+    std::atomic<QThread *> _readConnectionThread;
+
+    // Records by path, see loadMetadataSnapshot().
+    // Guarded by _snapshotMutex; when both are needed, _mutex is taken first.
+    std::unique_ptr<QHash<QByteArray, SyncJournalFileRecord>> _metadataSnapshot;
+    QMutex _snapshotMutex;
 
     SqlQuery _getFileRecordQuery;
     SqlQuery _getFileRecordQueryByMangledName;
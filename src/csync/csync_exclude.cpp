@@ -36,6 +36,7 @@
 
 #include <QString>
 #include <QFileInfo>
+#include <QVarLengthArray>
 
 
 /** Expands C-like escape sequences (in place)
@@ -274,6 +275,22 @@ void ExcludedFiles::addInTreeExcludeFilePath(const QString &path)
 {
     BasePathByteArray basePath = leftIncludeLast(path.toUtf8(), '/');
     _excludeFiles[basePath].append(path);
+    _inTreeExcludeFiles.insert(path);
+}
+
+void ExcludedFiles::loadInTreeExcludeFile(const QByteArray &dirPath)
+{
+    QString file = _localPath + QString::fromUtf8(dirPath);
+    if (!dirPath.isEmpty())
+        file += QLatin1Char('/');
+    file += QStringLiteral(".sync-exclude.lst");
+
+    BasePathByteArray basePath = leftIncludeLast(file.toUtf8(), '/');
+    if (_excludeFiles.value(basePath).contains(file))
+        return;
+
+    addInTreeExcludeFilePath(file);
+    loadExcludeFile(basePath, file);
 }
 
 void ExcludedFiles::setExcludeConflictFiles(bool onoff)
@@ -315,20 +332,38 @@ void ExcludedFiles::setWildcardsMatchSlash(bool onoff)
 
 bool ExcludedFiles::loadExcludeFile(const QByteArray & basePath, const QString & file)
 {
-    QFile f(file);
-    if (!f.open(QIODevice::ReadOnly))
+    QFileInfo fi(file);
+    if (!fi.exists()) {
+        _parsedExcludeFiles.remove(file);
         return false;
+    }
 
-    while (!f.atEnd()) {
-        QByteArray line = f.readLine().trimmed();
-        if (line.isEmpty() || line.startsWith('#'))
-            continue;
-        csync_exclude_expand_escapes(line);
-        _allExcludes[basePath].append(line);
+    // Only parse the file again if it changed
+    auto &parsed = _parsedExcludeFiles[file];
+    if (parsed.lastModified != fi.lastModified() || parsed.size != fi.size()) {
+        QFile f(file);
+        if (!f.open(QIODevice::ReadOnly)) {
+            _parsedExcludeFiles.remove(file);
+            return false;
+        }
+
+        parsed.patterns.clear();
+        while (!f.atEnd()) {
+            QByteArray line = f.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith('#'))
+                continue;
+            csync_exclude_expand_escapes(line);
+            parsed.patterns.append(line);
+        }
+        parsed.lastModified = fi.lastModified();
+        parsed.size = fi.size();
     }
 
+    if (!parsed.patterns.isEmpty())
+        _allExcludes[basePath].append(parsed.patterns);
+
     // nothing to prepare if the user decided to not exclude anything
-    if(_allExcludes.size())
+    if (_allExcludes.contains(basePath))
         prepare(basePath);
 
     return true;
@@ -344,11 +379,21 @@ bool ExcludedFiles::reloadExcludeFiles()
     _fullTraversalRegexDir.clear();
     _fullRegexFile.clear();
     _fullRegexDir.clear();
+    _bnameMatchers.clear();
 
     bool success = true;
     for (const auto& basePath : _excludeFiles.keys()) {
         for (const auto& file : _excludeFiles.value(basePath)) {
-            success = loadExcludeFile(basePath, file);
+            bool loaded = loadExcludeFile(basePath, file);
+            if (!loaded && _inTreeExcludeFiles.contains(file)) {
+                // The file was removed from the tree, forget about it
+                _inTreeExcludeFiles.remove(file);
+                _excludeFiles[basePath].removeAll(file);
+                if (_excludeFiles[basePath].isEmpty())
+                    _excludeFiles.remove(basePath);
+                continue;
+            }
+            success = loaded;
         }
     }
 
@@ -410,12 +455,22 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const char *path, ItemTy
     if (_allExcludes.isEmpty())
         return CSYNC_NOT_EXCLUDED;
 
-    // Directories are guaranteed to be visited before their files
-    if (filetype == ItemTypeDirectory) {
-        QFileInfo fi = QFileInfo(_localPath + path + "/.sync-exclude.lst");
-        if (fi.isReadable()) {
-            addInTreeExcludeFilePath(fi.absoluteFilePath());
-            loadExcludeFile(fi.absolutePath().toUtf8(), fi.absoluteFilePath());
+    // In-tree exclude files are loaded by csync, see loadInTreeExcludeFile()
+
+    if (filetype != ItemTypeDirectory && filetype != ItemTypeFile)
+        return CSYNC_NOT_EXCLUDED;
+
+    // Collect the base paths with patterns that apply to this path, deepest
+    // first. These are the parent directories of the path, down to _localPath.
+    // Keys that are a prefix of one another sort shortest first in the map.
+    const QByteArray fullPath = _localPath.toUtf8() + path;
+    const int localPathSize = fullPath.size() - static_cast<int>(strlen(path));
+    QVarLengthArray<QMap<BasePathByteArray, BnameMatcher>::const_iterator, 8> basePaths;
+    for (auto it = _bnameMatchers.constBegin(); it != _bnameMatchers.constEnd(); ++it) {
+        const auto &basePath = it.key();
+        if (basePath.size() >= localPathSize && basePath.size() < fullPath.size()
+            && fullPath.startsWith(basePath)) {
+            basePaths.prepend(it);
         }
     }
 
@@ -428,47 +483,48 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const char *path, ItemTy
     } else {
         bname = path;
     }
-    QString bnameStr = QString::fromUtf8(bname);
-
-    QByteArray basePath(_localPath.toUtf8() + path);
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, '/');
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _bnameTraversalRegexDir.contains(basePath)) {
-            m = _bnameTraversalRegexDir[basePath].match(bnameStr);
-        } else if (filetype == ItemTypeFile
-            && _bnameTraversalRegexFile.contains(basePath)) {
-            m = _bnameTraversalRegexFile[basePath].match(bnameStr);
-        } else {
-            continue;
+    const int blen = static_cast<int>(strlen(bname));
+    QString bnameStr;
+
+    for (const auto &it : basePaths) {
+        BnameMatcher::Result result;
+        if (!it->match(bname, blen, filetype, &result)) {
+            if (bnameStr.isNull())
+                bnameStr = QString::fromUtf8(bname, blen);
+            const auto &regex = filetype == ItemTypeDirectory
+                ? _bnameTraversalRegexDir[it.key()]
+                : _bnameTraversalRegexFile[it.key()];
+            QRegularExpressionMatch m = regex.match(bnameStr);
+            if (!m.hasMatch()) {
+                result = BnameMatcher::NoMatch;
+            } else if (m.capturedStart(QStringLiteral("exclude")) != -1) {
+                result = BnameMatcher::Exclude;
+            } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
+                result = BnameMatcher::ExcludeAndRemove;
+            } else {
+                result = BnameMatcher::Trigger;
+            }
         }
 
-        if (!m.hasMatch())
+        switch (result) {
+        case BnameMatcher::NoMatch:
             return CSYNC_NOT_EXCLUDED;
-        if (m.capturedStart(QStringLiteral("exclude")) != -1) {
+        case BnameMatcher::Exclude:
             return CSYNC_FILE_EXCLUDE_LIST;
-        } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
+        case BnameMatcher::ExcludeAndRemove:
             return CSYNC_FILE_EXCLUDE_AND_REMOVE;
+        case BnameMatcher::Trigger:
+            break;
         }
     }
 
     // third capture: full path matching is triggered
     QString pathStr = QString::fromUtf8(path);
-    basePath = _localPath.toUtf8() + path;
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, '/');
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _fullTraversalRegexDir.contains(basePath)) {
-            m = _fullTraversalRegexDir[basePath].match(pathStr);
-        } else if (filetype == ItemTypeFile
-            && _fullTraversalRegexFile.contains(basePath)) {
-            m = _fullTraversalRegexFile[basePath].match(pathStr);
-        } else {
-            continue;
-        }
-
+    for (const auto &it : basePaths) {
+        const auto &regex = filetype == ItemTypeDirectory
+            ? _fullTraversalRegexDir[it.key()]
+            : _fullTraversalRegexFile[it.key()];
+        QRegularExpressionMatch m = regex.match(pathStr);
         if (m.hasMatch()) {
             if (m.capturedStart(QStringLiteral("exclude")) != -1) {
                 return CSYNC_FILE_EXCLUDE_LIST;
@@ -526,6 +582,12 @@ auto ExcludedFiles::csyncTraversalMatchFun()
     return [this](const char *path, ItemType filetype) { return this->traversalPatternMatch(path, filetype); };
 }
 
+auto ExcludedFiles::csyncInTreeExcludeFileFun()
+    -> std::function<void(const QByteArray &dirPath)>
+{
+    return [this](const QByteArray &dirPath) { this->loadInTreeExcludeFile(dirPath); };
+}
+
 /**
  * On linux we used to use fnmatch with FNM_PATHNAME, but the windows function we used
  * didn't have that behavior. wildcardsMatchSlash can be used to control which behavior
@@ -657,6 +719,134 @@ static QString extractBnameTrigger(const QString &exclude, bool wildcardsMatchSl
     return pattern;
 }
 
+/** Whether the bytes are valid UTF-8 that survives the trip through QString unchanged */
+static bool isUtf8RoundTrip(const char *data, int len)
+{
+    const QByteArray bytes = QByteArray::fromRawData(data, len);
+    return QString::fromUtf8(bytes).toUtf8() == bytes;
+}
+
+static const char *nextCodePoint(const char *p, const char *end)
+{
+    ++p;
+    while (p != end && (static_cast<uchar>(*p) & 0xC0) == 0x80)
+        ++p;
+    return p;
+}
+
+/**
+ * Matches a pattern containing * and ? wildcards against a name.
+ *
+ * Both are valid UTF-8 and the wildcards consume whole code points, like
+ * the regex would. The name never contains a /.
+ */
+static bool wildcardMatch(const QByteArray &pattern, const char *name, const char *nameEnd)
+{
+    const char *p = pattern.constData();
+    const char *pEnd = p + pattern.size();
+    const char *starP = nullptr;
+    const char *starName = nullptr;
+
+    while (name != nameEnd) {
+        if (p != pEnd && *p == '*') {
+            starP = ++p;
+            starName = name;
+        } else if (p != pEnd && *p == '?') {
+            ++p;
+            name = nextCodePoint(name, nameEnd);
+        } else if (p != pEnd && *p == *name) {
+            ++p;
+            ++name;
+        } else if (starP) {
+            // Let the last * consume one more code point and retry
+            p = starP;
+            starName = nextCodePoint(starName, nameEnd);
+            name = starName;
+        } else {
+            return false;
+        }
+    }
+    while (p != pEnd && *p == '*')
+        ++p;
+    return p == pEnd;
+}
+
+void ExcludedFiles::BnameMatcher::addPattern(Result result, bool dirOnly, QByteArray pattern)
+{
+    // Bracket expressions and escapes are left to the regex
+    if (pattern.contains('[') || pattern.contains('\\')
+        || !isUtf8RoundTrip(pattern.constData(), pattern.size())) {
+        _complete = false;
+        return;
+    }
+    if (_caseInsensitive) {
+        // Only ASCII case folding is done here
+        for (char c : pattern) {
+            if (static_cast<uchar>(c) >= 0x80) {
+                _complete = false;
+                return;
+            }
+        }
+        pattern = pattern.toLower();
+    }
+
+    auto &patterns = _patterns[result][dirOnly ? 1 : 0];
+    if (pattern.contains('*') || pattern.contains('?')) {
+        patterns.wildcards.append(pattern);
+    } else {
+        patterns.literals.insert(pattern);
+    }
+}
+
+bool ExcludedFiles::BnameMatcher::match(const char *bname, int len, ItemType filetype, Result *result) const
+{
+    if (!_complete)
+        return false;
+
+    bool ascii = true;
+    for (int i = 0; i < len; ++i) {
+        const auto c = static_cast<uchar>(bname[i]);
+        // '.' in the regex doesn't match line breaks, a * here would
+        if (c == '\n' || c == '\r')
+            return false;
+        if (c >= 0x80)
+            ascii = false;
+    }
+    // Unicode case folding and invalid UTF-8 are left to the regex
+    if (!ascii && (_caseInsensitive || !isUtf8RoundTrip(bname, len)))
+        return false;
+
+    QVarLengthArray<char, 256> folded;
+    if (_caseInsensitive) {
+        folded.resize(len);
+        for (int i = 0; i < len; ++i) {
+            const char c = bname[i];
+            folded[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+        }
+        bname = folded.constData();
+    }
+
+    const auto name = QByteArray::fromRawData(bname, len);
+    const int variants = filetype == ItemTypeDirectory ? 2 : 1;
+    for (int r = Exclude; r != NoMatch; ++r) {
+        for (int dirOnly = 0; dirOnly < variants; ++dirOnly) {
+            const auto &patterns = _patterns[r][dirOnly];
+            if (patterns.literals.contains(name)) {
+                *result = static_cast<Result>(r);
+                return true;
+            }
+            for (const auto &pattern : patterns.wildcards) {
+                if (wildcardMatch(pattern, bname, bname + len)) {
+                    *result = static_cast<Result>(r);
+                    return true;
+                }
+            }
+        }
+    }
+    *result = NoMatch;
+    return true;
+}
+
 void ExcludedFiles::prepare()
 {
     // clear all regex
@@ -666,6 +856,7 @@ void ExcludedFiles::prepare()
     _fullTraversalRegexDir.clear();
     _fullRegexFile.clear();
     _fullRegexDir.clear();
+    _bnameMatchers.clear();
 
     for (auto const & basePath : _allExcludes.keys())
         prepare(basePath);
@@ -709,6 +900,8 @@ void ExcludedFiles::prepare(const BasePathByteArray & basePath)
     QString bnameTriggerFileDir;
     QString bnameTriggerDir;
 
+    BnameMatcher matcher(OCC::Utility::fsCasePreserving());
+
     auto regexAppend = [](QString &fileDirPattern, QString &dirPattern, const QString &appendMe, bool dirOnly) {
         QString &pattern = dirOnly ? dirPattern : fileDirPattern;
         if (!pattern.isEmpty())
@@ -750,6 +943,8 @@ void ExcludedFiles::prepare(const BasePathByteArray & basePath)
         auto regexExclude = convertToRegexpSyntax(QString::fromUtf8(exclude), _wildcardsMatchSlash);
         if (!fullPath) {
             regexAppend(bnameFileDir, bnameDir, regexExclude, matchDirOnly);
+            matcher.addPattern(removeExcluded ? BnameMatcher::ExcludeAndRemove : BnameMatcher::Exclude,
+                matchDirOnly, exclude);
         } else {
             regexAppend(fullFileDir, fullDir, regexExclude, matchDirOnly);
 
@@ -757,8 +952,10 @@ void ExcludedFiles::prepare(const BasePathByteArray & basePath)
             QString bnameExclude = extractBnameTrigger(exclude, _wildcardsMatchSlash);
             auto regexBname = convertToRegexpSyntax(bnameExclude, true);
             regexAppend(bnameTriggerFileDir, bnameTriggerDir, regexBname, matchDirOnly);
+            matcher.addPattern(BnameMatcher::Trigger, matchDirOnly, bnameExclude.toUtf8());
         }
     }
+    _bnameMatchers[basePath] = matcher;
 
     // The empty pattern would match everything - change it to match-nothing
     auto emptyMatchNothing = [](QString &pattern) {
@@ -25,10 +25,13 @@
 
 #include "csync.h"
 
+#include <QDateTime>
+#include <QHash>
 #include <QObject>
 #include <QSet>
 #include <QString>
 #include <QRegularExpression>
+#include <QVector>
 
 #include <functional>
 
@@ -77,6 +80,17 @@ public:
     void addExcludeFilePath(const QString &path);
     void addInTreeExcludeFilePath(const QString &path);
 
+    /**
+     * Registers and loads the .sync-exclude.lst of a directory.
+     *
+     * Called during discovery for directories whose listing contains the
+     * file. Does nothing if the file is already registered: then
+     * reloadExcludeFiles() has loaded its current content.
+     *
+     * @param dirPath      folder-relative path of the directory, "" for the root
+     */
+    void loadInTreeExcludeFile(const QByteArray &dirPath);
+
     /**
      * Whether conflict files shall be excluded.
      *
@@ -126,6 +140,16 @@ public:
     auto csyncTraversalMatchFun()
         -> std::function<CSYNC_EXCLUDE_TYPE(const char *path, ItemType filetype)>;
 
+    /**
+     * Generate a hook that csync calls for directories containing
+     * an in-tree exclude file, see loadInTreeExcludeFile().
+     *
+     * Careful: The function will only be valid for as long as this
+     * ExcludedFiles instance stays alive.
+     */
+    auto csyncInTreeExcludeFileFun()
+        -> std::function<void(const QByteArray &dirPath)>;
+
 public slots:
     /**
      * Reloads the exclude patterns from the registered paths.
@@ -219,11 +243,64 @@ private:
 
     void prepare();
 
+    /**
+     * Matches a bname against the patterns of _bnameTraversalRegex without
+     * going through QRegularExpression.
+     *
+     * Patterns using only literal characters, * and ? (nearly all patterns seen
+     * in practice) are compared directly on the UTF-8 bytes. Literals are found
+     * with a hash lookup. If a base path has other patterns, or a bname can't be
+     * compared bytewise, match() refuses and the regex is used instead.
+     */
+    class BnameMatcher
+    {
+    public:
+        // Ordered by precedence, like the capture groups of _bnameTraversalRegex
+        enum Result {
+            Exclude,
+            ExcludeAndRemove,
+            Trigger,
+            NoMatch
+        };
+
+        explicit BnameMatcher(bool caseInsensitive = false)
+            : _caseInsensitive(caseInsensitive)
+        {
+        }
+
+        void addPattern(Result result, bool dirOnly, QByteArray pattern);
+
+        /** Returns false if the regex must be used to decide about this bname. */
+        bool match(const char *bname, int len, ItemType filetype, Result *result) const;
+
+    private:
+        struct Patterns
+        {
+            QSet<QByteArray> literals;
+            QVector<QByteArray> wildcards;
+        };
+        Patterns _patterns[NoMatch][2]; // indexed by result and dirOnly
+        bool _caseInsensitive;
+        bool _complete = true; // whether all patterns could be added
+    };
+
 
     QString _localPath;
     /// Files to load excludes from
     QMap<BasePathByteArray, QList<QString>> _excludeFiles;
 
+    /// The subset of _excludeFiles that was found in the synced tree
+    QSet<QString> _inTreeExcludeFiles;
+
+    /// Patterns read from an exclude file, reused while the file is unchanged
+    struct ParsedExcludeFile
+    {
+        QDateTime lastModified;
+        qint64 size = -1;
+        QList<QByteArray> patterns;
+    };
+    QHash<QString, ParsedExcludeFile> _parsedExcludeFiles;
+
     /// Exclude patterns added with addManualExclude()
     QMap<BasePathByteArray, QList<QByteArray>> _manualExcludes;
 
@@ -237,6 +314,7 @@ private:
     QMap<BasePathByteArray, QRegularExpression> _fullTraversalRegexDir;
     QMap<BasePathByteArray, QRegularExpression> _fullRegexFile;
     QMap<BasePathByteArray, QRegularExpression> _fullRegexDir;
+    QMap<BasePathByteArray, BnameMatcher> _bnameMatchers;
 
     bool _excludeConflictFiles = true;
 
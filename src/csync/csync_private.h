@@ -115,21 +115,38 @@ struct ByteArrayRefHash { uint operator()(const ByteArrayRef &a) const { return
 struct OCSYNC_EXPORT csync_s {
 
   class FileMap : public std::unordered_map<ByteArrayRef, std::unique_ptr<csync_file_stat_t>, ByteArrayRefHash> {
+      using Base = std::unordered_map<ByteArrayRef, std::unique_ptr<csync_file_stat_t>, ByteArrayRefHash>;
+
+      /* Secondary index from e2eMangledName to the entry, kept up to date by insertFile() */
+      std::unordered_map<ByteArrayRef, csync_file_stat_t *, ByteArrayRefHash> _mangledNames;
+
   public:
       csync_file_stat_t *findFile(const ByteArrayRef &key) const {
           auto it = find(key);
           return it != end() ? it->second.get() : nullptr;
       }
       csync_file_stat_t *findFileMangledName(const ByteArrayRef &key) const {
-          auto it = begin();
-          while (it != end()) {
-              csync_file_stat_t *fs = it->second.get();
-              if (fs->e2eMangledName == key) {
-                  return fs;
-              }
-              ++it;
+          auto it = _mangledNames.find(key);
+          return it != _mangledNames.end() ? it->second : nullptr;
+      }
+
+      /* Inserts or replaces the entry at key. Use this instead of operator[]
+       * so that findFileMangledName() can see the entry. */
+      void insertFile(const ByteArrayRef &key, std::unique_ptr<csync_file_stat_t> fs) {
+          auto &slot = (*this)[key];
+          if (slot && !slot->e2eMangledName.isEmpty()) {
+              auto it = _mangledNames.find(slot->e2eMangledName);
+              if (it != _mangledNames.end() && it->second == slot.get())
+                  _mangledNames.erase(it);
           }
-          return nullptr;
+          if (fs && !fs->e2eMangledName.isEmpty())
+              _mangledNames[fs->e2eMangledName] = fs.get();
+          slot = std::move(fs);
+      }
+
+      void clear() {
+          _mangledNames.clear();
+          Base::clear();
       }
   };
 
@@ -165,6 +182,15 @@ struct OCSYNC_EXPORT csync_s {
    */
   std::function<CSYNC_EXCLUDE_TYPE(const char *path, ItemType filetype)> exclude_traversal_fn;
 
+  /**
+   * Called during local discovery for each directory containing a
+   * .sync-exclude.lst, before its entries are checked for exclusion.
+   * The path is relative to the local root, "" for the root itself.
+   *
+   * See ExcludedFiles::loadInTreeExcludeFile().
+   */
+  std::function<void(const QByteArray &dirPath)> exclude_in_tree_file_fn;
+
   struct {
     std::unordered_map<ByteArrayRef, QByteArray, ByteArrayRefHash> folder_renamed_to; // map from->to
     std::unordered_map<ByteArrayRef, QByteArray, ByteArrayRefHash> folder_renamed_from; // map to->from
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <vector>
 
 #include "c_lib.h"
 
@@ -191,8 +192,7 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
 
   /*
    * When file is encrypted it's phash (path hash) will not match the local file phash,
-   * we could match the e2eMangledName but that might be slow wihout index, and it's
-   * not UNIQUE at the moment.
+   * so look it up by e2eMangledName (indexed, but not UNIQUE at the moment).
    */
   if (!base.isValid()) {
       if(!ctx->statedb->getFileRecordByE2eMangledName(fs->path, &base)) {
@@ -452,10 +452,10 @@ out:
   QByteArray path = fs->path;
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      ctx->local.files[path] = std::move(fs);
+      ctx->local.files.insertFile(path, std::move(fs));
       break;
     case REMOTE_REPLICA:
-      ctx->remote.files[path] = std::move(fs);
+      ctx->remote.files.insertFile(path, std::move(fs));
       break;
     default:
       break;
@@ -552,7 +552,7 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
         }
 
         /* store into result list. */
-        files[rec._path] = std::move(st);
+        files.insertFile(rec._path, std::move(st));
         ++count;
     };
 
@@ -592,6 +592,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   QByteArray fullpath;
   csync_vio_handle_t *dh = NULL;
   std::unique_ptr<csync_file_stat_t> dirent;
+  std::vector<std::unique_ptr<csync_file_stat_t>> dirents;
   csync_file_stat_t *previous_fs = NULL;
   int read_from_db = 0;
   int rc = 0;
@@ -668,6 +669,8 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
   }
 
+  // Read the whole listing before looking at the entries: an in-tree exclude
+  // file must be loaded before any of its siblings is checked for exclusion.
   while (true) {
     // Get the next item in the directory
     errno = 0;
@@ -682,6 +685,25 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
         // Normal case: End of items in directory
         break;
     }
+    dirents.push_back(std::move(dirent));
+  }
+  csync_vio_closedir(ctx, dh);
+  dh = NULL;
+
+  if (ctx->current == LOCAL_REPLICA && ctx->exclude_in_tree_file_fn) {
+      for (const auto &entry : dirents) {
+          if (entry->path == ".sync-exclude.lst") {
+              const char *local_uri = uri + strlen(ctx->local.uri);
+              if (*local_uri == '/')
+                  ++local_uri;
+              ctx->exclude_in_tree_file_fn(QByteArray(local_uri));
+              break;
+          }
+      }
+  }
+
+  for (auto &entry : dirents) {
+    dirent = std::move(entry);
 
     /* Conversion error */
     if (dirent->path.isEmpty() && !dirent->original_path.isEmpty()) {
@@ -776,7 +798,6 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     ctx->remote.read_from_db = read_from_db;
   }
 
-  csync_vio_closedir(ctx, dh);
   qCInfo(lcUpdate, " <= Closing walk for %s with read_from_db %d", uri, read_from_db);
 
   return rc;
@@ -665,7 +665,7 @@ void AccountSettings::slotCustomContextMenuRequested(const QPoint &pos)
 
     if (!folderPaused) {
         ac = menu->addAction(tr("Force sync now"));
-        if (folderMan->currentSyncFolder() == folderMan->folder(alias)) {
+        if (folderMan->currentSyncFolders().contains(folderMan->folder(alias))) {
             ac->setText(tr("Restart sync"));
         }
         ac->setEnabled(folderConnected);
@@ -937,11 +937,9 @@ void AccountSettings::slotForceSyncCurrentFolder()
 {
     FolderMan *folderMan = FolderMan::instance();
     if (auto selectedFolder = folderMan->folder(selectedFolderAlias())) {
-        // Terminate and reschedule any running sync
-        if (Folder *current = folderMan->currentSyncFolder()) {
-            folderMan->terminateSyncProcess();
-            folderMan->scheduleFolder(current);
-        }
+        // Terminate a running sync of this folder, other folders may go on
+        if (folderMan->currentSyncFolders().contains(selectedFolder))
+            selectedFolder->slotTerminateSync();
 
         // Insert the selected folder at the front of the queue
         folderMan->scheduleFolderNext(selectedFolder);
@@ -306,7 +306,7 @@ void Folder::etagRetreived(const QString &etag)
     if (_lastEtag != etag) {
         qCInfo(lcFolder) << "Compare etag with previous etag: last:" << _lastEtag << ", received:" << etag << "-> CHANGED";
         _lastEtag = etag;
-        slotScheduleThisFolder();
+        FolderMan::instance()->scheduleFolder(this, FolderMan::SyncPriority::Background);
     }
 
     _accountState->tagLastSuccessfullETagRequest();
@@ -660,11 +660,34 @@ void Folder::startSync(const QStringList &pathList)
     bool periodicFullLocalDiscoveryNow =
         fullLocalDiscoveryInterval.count() >= 0 // negative means we don't require periodic full runs
         && _timeSinceLastFullLocalDiscovery.hasExpired(fullLocalDiscoveryInterval.count());
+    if (periodicFullLocalDiscoveryNow
+        && !_localDiscoveryPaths.empty()
+        && !_timeSinceLastFullLocalDiscovery.hasExpired(2 * fullLocalDiscoveryInterval.count())) {
+        // The periodic run is only a consistency check: postpone it to a sync
+        // that isn't triggered by local changes, so it doesn't delay them.
+        qCInfo(lcFolder) << "Postponing the periodic full local discovery while local files change";
+        periodicFullLocalDiscoveryNow = false;
+    }
     if (_folderWatcher && _folderWatcher->isReliable()
         && hasDoneFullLocalDiscovery
         && !periodicFullLocalDiscoveryNow) {
         qCInfo(lcFolder) << "Allowing local discovery to read from the database";
-        _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem, _localDiscoveryPaths);
+
+        // Folders the watcher can't observe are scanned by every sync
+        std::set<QByteArray> unwatchedSubtrees;
+        for (auto unwatched : _folderWatcher->unwatchedPaths()) {
+            // The watcher stores the paths without trailing slash, path() has one;
+            // the root itself becomes an empty subtree, that is, the whole folder
+            if (!unwatched.endsWith(QLatin1Char('/')))
+                unwatched += QLatin1Char('/');
+            if (unwatched.startsWith(path())) {
+                QString relative = unwatched.mid(path().size());
+                relative.chop(1);
+                unwatchedSubtrees.insert(relative.toUtf8());
+            }
+        }
+        _engine->setLocalDiscoveryOptions(LocalDiscoveryStyle::DatabaseAndFilesystem,
+            _localDiscoveryPaths, std::move(unwatchedSubtrees));
 
         if (lcFolder().isDebugEnabled()) {
             QByteArrayList paths;
@@ -697,6 +720,7 @@ void Folder::setSyncOptions()
     opt._newBigFolderSizeLimit = newFolderLimit.first ? newFolderLimit.second * 1000LL * 1000LL : -1; // convert from MB to B
     opt._confirmExternalStorage = cfgFile.confirmExternalStorage();
     opt._moveFilesToTrash = cfgFile.moveToTrash();
+    opt._bulkInitialDiscovery = cfgFile.bulkInitialDiscovery();
 
     QByteArray chunkSizeEnv = qgetenv("OWNCLOUD_CHUNK_SIZE");
     if (!chunkSizeEnv.isEmpty()) {
@@ -1036,6 +1060,11 @@ void Folder::warnOnNewExcludedItem(const SyncJournalFileRecord &record, const QS
     Logger::instance()->postOptionalGuiLog(Theme::instance()->appNameGUI(), message);
 }
 
+bool Folder::hasUnwatchedPaths() const
+{
+    return _folderWatcher && !_folderWatcher->unwatchedPaths().isEmpty();
+}
+
 void Folder::slotWatcherUnreliable(const QString &message)
 {
     qCWarning(lcFolder) << "Folder watcher for" << path() << "became unreliable:" << message;
@@ -1074,6 +1103,8 @@ void Folder::registerFolderWatcher()
         this, &Folder::slotWatchedPathChanged);
     connect(_folderWatcher.data(), &FolderWatcher::lostChanges,
         this, &Folder::slotNextSyncFullLocalDiscovery);
+    connect(_folderWatcher.data(), &FolderWatcher::lostChanges,
+        this, &Folder::scheduleThisFolderSoon);
     connect(_folderWatcher.data(), &FolderWatcher::becameUnreliable,
         this, &Folder::slotWatcherUnreliable);
     _folderWatcher->init(path());
@@ -238,6 +238,13 @@ public:
      */
     void registerFolderWatcher();
 
+    /**
+     * Whether parts of the folder aren't covered by the folder watcher.
+     *
+     * Changes there are only found by syncs, so they should run regularly.
+     */
+    bool hasUnwatchedPaths() const;
+
 signals:
     void syncStateChange();
     void syncStarted();
@@ -38,6 +38,7 @@
 #include <QMutableSetIterator>
 #include <QSet>
 #include <QNetworkProxy>
+#include <QNetworkReply>
 
 namespace OCC {
 
@@ -45,9 +46,11 @@ Q_LOGGING_CATEGORY(lcFolderMan, "nextcloud.gui.folder.manager", QtInfoMsg)
 
 FolderMan *FolderMan::_instance = nullptr;
 
+// How often folders with parts the folder watcher can't observe are synced
+static const std::chrono::minutes unwatchedPathsPollInterval(5);
+
 FolderMan::FolderMan(QObject *parent)
     : QObject(parent)
-    , _currentSyncFolder(nullptr)
     , _syncEnabled(true)
     , _lockWatcher(new LockWatcher)
     , _navigationPaneHelper(this)
@@ -107,6 +110,7 @@ void FolderMan::unloadFolder(Folder *f)
     _socketApi->slotUnregisterPath(f->alias());
 
     _folderMap.remove(f->alias());
+    _etagBatchJobs.remove(f);
 
     disconnect(f, &Folder::syncStarted,
         this, &FolderMan::slotFolderSyncStarted);
@@ -138,8 +142,9 @@ int FolderMan::unloadAndDeleteAllFolders()
     ASSERT(_folderMap.isEmpty());
 
     _lastSyncFolder = nullptr;
-    _currentSyncFolder = nullptr;
+    _currentSyncFolders.clear();
     _scheduledFolders.clear();
+    _backgroundScheduledFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
 
@@ -472,15 +477,14 @@ void FolderMan::slotFolderCanSyncChanged()
     }
 }
 
-// this really terminates the current sync process
+// this really terminates the current sync processes
 // ie. no questions, no prisoners
 // csync still remains in a stable state, regardless of that.
 void FolderMan::terminateSyncProcess()
 {
-    Folder *f = _currentSyncFolder;
-    if (f) {
+    foreach (Folder *f, _currentSyncFolders) {
         // This will, indirectly and eventually, call slotFolderSyncFinished
-        // and thereby clear _currentSyncFolder.
+        // and thereby remove it from _currentSyncFolders.
         f->slotTerminateSync();
     }
 }
@@ -519,7 +523,7 @@ void FolderMan::slotSyncOnceFileUnlocks(const QString &path)
   * if a folder wants to be synced, it calls this slot and is added
   * to the queue. The slot to actually start a sync is called afterwards.
   */
-void FolderMan::scheduleFolder(Folder *f)
+void FolderMan::scheduleFolder(Folder *f, SyncPriority priority)
 {
     if (!f) {
         qCCritical(lcFolderMan) << "slotScheduleSync called with null folder";
@@ -537,7 +541,12 @@ void FolderMan::scheduleFolder(Folder *f)
         }
         f->prepareToSync();
         emit folderSyncStateChange(f);
-        _scheduledFolders.enqueue(f);
+        enqueueFolder(f, priority);
+        emit scheduleQueueChanged();
+    } else if (priority == SyncPriority::Normal && _backgroundScheduledFolders.contains(f)) {
+        qCInfo(lcFolderMan) << "Sync for folder " << alias << " already scheduled, raising its priority";
+        _scheduledFolders.removeAll(f);
+        enqueueFolder(f, priority);
         emit scheduleQueueChanged();
     } else {
         qCInfo(lcFolderMan) << "Sync for folder " << alias << " already scheduled, do not enqueue!";
@@ -546,6 +555,22 @@ void FolderMan::scheduleFolder(Folder *f)
     startScheduledSyncSoon();
 }
 
+void FolderMan::enqueueFolder(Folder *f, SyncPriority priority)
+{
+    if (priority == SyncPriority::Background) {
+        _backgroundScheduledFolders.insert(f);
+        _scheduledFolders.enqueue(f);
+        return;
+    }
+
+    // Behind the other normal syncs, but ahead of the background ones
+    _backgroundScheduledFolders.remove(f);
+    int pos = 0;
+    while (pos < _scheduledFolders.size() && !_backgroundScheduledFolders.contains(_scheduledFolders.at(pos)))
+        ++pos;
+    _scheduledFolders.insert(pos, f);
+}
+
 void FolderMan::scheduleFolderNext(Folder *f)
 {
     auto alias = f->alias();
@@ -557,6 +582,7 @@ void FolderMan::scheduleFolderNext(Folder *f)
     }
 
     _scheduledFolders.removeAll(f);
+    _backgroundScheduledFolders.remove(f);
 
     f->prepareToSync();
     emit folderSyncStateChange(f);
@@ -596,7 +622,7 @@ void FolderMan::slotRunOneEtagJob()
             //qCDebug(lcFolderMan) << "No more remote ETag check jobs to schedule.";
 
             /* now it might be a good time to check for restarting... */
-            if (_currentSyncFolder == nullptr && _appRestartRequired) {
+            if (_currentSyncFolders.isEmpty() && _appRestartRequired) {
                 restartApplication();
             }
         } else {
@@ -621,16 +647,16 @@ void FolderMan::slotAccountStateChanged()
             if (f
                 && f->canSync()
                 && f->accountState() == accountState) {
-                scheduleFolder(f);
+                scheduleFolder(f, SyncPriority::Background);
             }
         }
     } else {
         qCInfo(lcFolderMan) << "Account" << accountName << "disconnected or paused, "
                                                            "terminating or descheduling sync folders";
 
-        if (_currentSyncFolder
-            && _currentSyncFolder->accountState() == accountState) {
-            _currentSyncFolder->slotTerminateSync();
+        foreach (Folder *f, _currentSyncFolders) {
+            if (f->accountState() == accountState)
+                f->slotTerminateSync();
         }
 
         QMutableListIterator<Folder *> it(_scheduledFolders);
@@ -638,6 +664,7 @@ void FolderMan::slotAccountStateChanged()
             Folder *f = it.next();
             if (f->accountState() == accountState) {
                 it.remove();
+                _backgroundScheduledFolders.remove(f);
             }
         }
         emit scheduleQueueChanged();
@@ -665,7 +692,7 @@ void FolderMan::startScheduledSyncSoon()
     if (_scheduledFolders.empty()) {
         return;
     }
-    if (_currentSyncFolder) {
+    if (_currentSyncFolders.size() >= maximumConcurrentSyncs()) {
         return;
     }
 
@@ -700,11 +727,15 @@ void FolderMan::startScheduledSyncSoon()
   * slot to start folder syncs.
   * It is either called from the slot where folders enqueue themselves for
   * syncing or after a folder sync was finished.
+  *
+  * Several folders may sync at the same time. Normal syncs go before
+  * background ones, and folders of accounts with fewer running syncs go
+  * first so one account with many folders doesn't hold up the others.
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (_currentSyncFolder) {
-        qCInfo(lcFolderMan) << "Currently folder " << _currentSyncFolder->remoteUrl().toString() << " is running, wait for finish!";
+    if (_currentSyncFolders.size() >= maximumConcurrentSyncs()) {
+        qCInfo(lcFolderMan) << _currentSyncFolders.size() << "folders are syncing, wait for one to finish!";
         return;
     }
 
@@ -718,15 +749,7 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder *folder = nullptr;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
-            break;
-        }
-    }
+    Folder *folder = takeNextScheduledFolder();
 
     emit scheduleQueueChanged();
 
@@ -737,21 +760,80 @@ void FolderMan::slotStartScheduledFolderSync()
         folder->registerFolderWatcher();
         registerFolderWithSocketApi(folder);
 
-        _currentSyncFolder = folder;
+        _currentSyncFolders.append(folder);
         folder->startSync(QStringList());
+
+        // There may be room for more
+        startScheduledSyncSoon();
     }
 }
 
+Folder *FolderMan::takeNextScheduledFolder()
+{
+    // Find the best folder in the queue that can be synced.
+    Folder *folder = nullptr;
+    int folderRank = 0;
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext()) {
+        Folder *g = it.next();
+        if (!g->canSync()) {
+            it.remove();
+            _backgroundScheduledFolders.remove(g);
+            continue;
+        }
+        if (_currentSyncFolders.contains(g)) {
+            // Scheduled again while syncing, wait for that to finish
+            continue;
+        }
+        int rank = 0;
+        foreach (Folder *running, _currentSyncFolders) {
+            if (running->accountState() == g->accountState())
+                ++rank;
+        }
+        if (_backgroundScheduledFolders.contains(g))
+            rank += maximumConcurrentSyncs();
+        if (!folder || rank < folderRank) {
+            folder = g;
+            folderRank = rank;
+        }
+    }
+    if (folder) {
+        _scheduledFolders.removeOne(folder);
+        _backgroundScheduledFolders.remove(folder);
+    }
+    return folder;
+}
+
+int FolderMan::maximumConcurrentSyncs()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_CONCURRENT_SYNCS").toUInt();
+    return max > 0 ? max : 3;
+}
+
+// The remote directory whose listing contains the etag of the folder at
+// remotePath: its parent, or itself for the root folder
+static QString etagBatchPath(QString remotePath)
+{
+    if (remotePath.endsWith(QLatin1Char('/')))
+        remotePath.chop(1);
+    int slash = remotePath.lastIndexOf(QLatin1Char('/'));
+    return slash <= 0 ? QStringLiteral("/") : remotePath.left(slash);
+}
+
 void FolderMan::slotEtagPollTimerTimeout()
 {
     ConfigFile cfg;
     auto polltime = cfg.remotePollInterval();
 
+    // Folders of an account that have the same parent directory on the
+    // server are checked together with one listing of that directory.
+    QMap<QPair<AccountState *, QString>, QList<Folder *>> batches;
+
     foreach (Folder *f, _folderMap) {
         if (!f) {
             continue;
         }
-        if (_currentSyncFolder == f) {
+        if (_currentSyncFolders.contains(f)) {
             continue;
         }
         if (_scheduledFolders.contains(f)) {
@@ -760,16 +842,55 @@ void FolderMan::slotEtagPollTimerTimeout()
         if (_disabledFolders.contains(f)) {
             continue;
         }
-        if (f->etagJob() || f->isBusy() || !f->canSync()) {
+        if (f->etagJob() || _etagBatchJobs.value(f) || f->isBusy() || !f->canSync()) {
             continue;
         }
         if (f->msecSinceLastSync() < polltime) {
             continue;
         }
-        QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+        if (!f->accountState()->account()->rootEtagChangesNotOnlySubFolderEtags()) {
+            // Such servers need the etags of the folder's contents as well
+            QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+            continue;
+        }
+        batches[qMakePair(f->accountState(), etagBatchPath(f->remotePath()))].append(f);
+    }
+
+    for (auto it = batches.constBegin(); it != batches.constEnd(); ++it) {
+        if (it.value().size() == 1) {
+            QMetaObject::invokeMethod(it.value().first(), "slotRunEtagJob", Qt::QueuedConnection);
+        } else {
+            startEtagBatchJob(it.key().first, it.key().second, it.value());
+        }
     }
 }
 
+void FolderMan::startEtagBatchJob(AccountState *accountState, const QString &path, const QList<Folder *> &folders)
+{
+    qCInfo(lcFolderMan) << "Checking" << folders.size() << "folders in" << path << "for changes via ETag check";
+
+    QHash<QString, QPointer<Folder>> foldersByPath;
+    foreach (Folder *f, folders) {
+        foldersByPath.insert(f->remotePath(), f);
+    }
+
+    auto job = new EtagBatchJob(accountState->account(), path, foldersByPath.keys(), this);
+    foreach (Folder *f, folders) {
+        _etagBatchJobs.insert(f, job);
+    }
+
+    connect(job, &EtagBatchJob::etagRetrieved, this,
+        [foldersByPath](const QString &folderPath, const QString &etag) {
+            if (auto f = foldersByPath.value(folderPath))
+                QMetaObject::invokeMethod(f, "etagRetreived", Q_ARG(QString, etag));
+        });
+    connect(job, &EtagBatchJob::folderNotListed, this, [foldersByPath](const QString &folderPath) {
+        if (auto f = foldersByPath.value(folderPath))
+            QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+    });
+    job->start();
+}
+
 void FolderMan::slotRemoveFoldersForAccount(AccountState *accountState)
 {
     QVarLengthArray<Folder *, 16> foldersToRemove;
@@ -835,7 +956,15 @@ void FolderMan::slotScheduleFolderByTime()
                                 << "because it has been" << msecsSinceSync.count() << "ms "
                                 << "since the last sync";
 
-            scheduleFolder(f);
+            scheduleFolder(f, SyncPriority::Background);
+            continue;
+        }
+
+        // Changes in folders the watcher can't observe are found by scanning
+        if (f->hasUnwatchedPaths() && msecsSinceSync > unwatchedPathsPollInterval) {
+            qCInfo(lcFolderMan) << "Scheduling folder" << f->alias()
+                                << "to scan the folders that are not watched";
+            scheduleFolder(f, SyncPriority::Background);
             continue;
         }
 
@@ -853,7 +982,7 @@ void FolderMan::slotScheduleFolderByTime()
                                 << ", last status:" << f->syncResult().statusString()
                                 << ", time since last sync:" << msecsSinceSync.count();
 
-            scheduleFolder(f);
+            scheduleFolder(f, SyncPriority::Background);
             continue;
         }
 
@@ -863,10 +992,12 @@ void FolderMan::slotScheduleFolderByTime()
 
 void FolderMan::slotFolderSyncStarted()
 {
+    auto f = qobject_cast<Folder *>(sender());
+    ASSERT(f);
     qCInfo(lcFolderMan, ">========== Sync started for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
 }
 
 /*
@@ -877,13 +1008,15 @@ void FolderMan::slotFolderSyncStarted()
   */
 void FolderMan::slotFolderSyncFinished(const SyncResult &)
 {
+    auto f = qobject_cast<Folder *>(sender());
+    ASSERT(f);
     qCInfo(lcFolderMan, "<========== Sync finished for folder [%s] of account [%s] with remote [%s]",
-        qPrintable(_currentSyncFolder->shortGuiLocalPath()),
-        qPrintable(_currentSyncFolder->accountState()->account()->displayName()),
-        qPrintable(_currentSyncFolder->remoteUrl().toString()));
+        qPrintable(f->shortGuiLocalPath()),
+        qPrintable(f->accountState()->account()->displayName()),
+        qPrintable(f->remoteUrl().toString()));
 
-    _lastSyncFolder = _currentSyncFolder;
-    _currentSyncFolder = nullptr;
+    _lastSyncFolder = f;
+    _currentSyncFolders.removeAll(f);
 
     startScheduledSyncSoon();
 }
@@ -1001,12 +1134,13 @@ void FolderMan::removeFolder(Folder *f)
 
     qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-    const bool currentlyRunning = (_currentSyncFolder == f);
+    const bool currentlyRunning = _currentSyncFolders.contains(f);
     if (currentlyRunning) {
         // abort the sync now
-        terminateSyncProcess();
+        f->slotTerminateSync();
     }
 
+    _backgroundScheduledFolders.remove(f);
     if (_scheduledFolders.removeAll(f) > 0) {
         emit scheduleQueueChanged();
     }
@@ -1126,12 +1260,15 @@ void FolderMan::slotWipeFolderForAccount(AccountState *accountState)
 
         qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-        const bool currentlyRunning = (_currentSyncFolder == f);
+        const bool currentlyRunning = _currentSyncFolders.contains(f);
         if (currentlyRunning) {
-            // abort the sync now
-            terminateSyncProcess();
+            // abort the sync now, the folder is deleted below and must
+            // not keep its sync slot
+            f->slotTerminateSync();
+            _currentSyncFolders.removeAll(f);
         }
 
+        _backgroundScheduledFolders.remove(f);
         if (_scheduledFolders.removeAll(f) > 0) {
             emit scheduleQueueChanged();
         }
@@ -1168,6 +1305,9 @@ void FolderMan::slotWipeFolderForAccount(AccountState *accountState)
         _navigationPaneHelper.scheduleUpdateCloudStorageRegistry();
     }
 
+    // Syncs of other folders may use the freed slots
+    startScheduledSyncSoon();
+
     emit folderListChanged(_folderMap);
     emit wipeDone(accountState, success);
 }
@@ -1473,9 +1613,9 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
     return _scheduledFolders;
 }
 
-Folder *FolderMan::currentSyncFolder() const
+QList<Folder *> FolderMan::currentSyncFolders() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders;
 }
 
 void FolderMan::restartApplication()
@@ -57,11 +57,24 @@ class LockWatcher;
  * - There was a sync error or a follow-up sync is requested
  *   (_timeScheduler and slotScheduleFolderByTime()
  *    and Folder::slotSyncFinished())
+ *
+ * Several folders can sync at the same time, three unless overridden by
+ * OWNCLOUD_MAX_CONCURRENT_SYNCS. Syncs requested by the user or the folder
+ * watcher go before the background ones from polling, and folders of an
+ * account with fewer running syncs are preferred.
  */
 class FolderMan : public QObject
 {
     Q_OBJECT
 public:
+    /** How urgently a scheduled folder should be synced. */
+    enum class SyncPriority {
+        /// Periodic syncs and remote change polling
+        Background,
+        /// User requests and local changes
+        Normal,
+    };
+
     ~FolderMan();
     static FolderMan *instance();
 
@@ -157,9 +170,12 @@ public:
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      */
-    Folder *currentSyncFolder() const;
+    QList<Folder *> currentSyncFolders() const;
+
+    /** The number of folders that may sync at the same time. */
+    static int maximumConcurrentSyncs();
 
     /** Removes all folders */
     int unloadAndDeleteAllFolders();
@@ -170,8 +186,13 @@ public:
      */
     void setSyncEnabled(bool);
 
-    /** Queues a folder for syncing. */
-    void scheduleFolder(Folder *);
+    /**
+     * Queues a folder for syncing.
+     *
+     * Normal syncs are queued before all background ones. Scheduling an
+     * already queued background sync with normal priority raises it.
+     */
+    void scheduleFolder(Folder *, SyncPriority priority = SyncPriority::Normal);
 
     /** Puts a folder in the very front of the queue. */
     void scheduleFolderNext(Folder *);
@@ -301,10 +322,20 @@ private:
 
     void setupFoldersHelper(QSettings &settings, AccountStatePtr account, bool backwardsCompatible);
 
+    void enqueueFolder(Folder *f, SyncPriority priority);
+
+    /** Removes the folder that should sync next from the queue, or returns
+     *  nullptr if none of the queued folders can start now. */
+    Folder *takeNextScheduledFolder();
+
+    /** Checks the etags of several folders that share the parent \a path
+     *  with a single PROPFIND. */
+    void startEtagBatchJob(AccountState *accountState, const QString &path, const QList<Folder *> &folders);
+
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder;
+    QList<Folder *> _currentSyncFolders;
     QPointer<Folder> _lastSyncFolder;
     bool _syncEnabled;
 
@@ -312,6 +343,8 @@ private:
     QTimer _etagPollTimer;
     /// The currently running etag query
     QPointer<RequestEtagJob> _currentEtagJob;
+    /// The running batched etag queries, by folder
+    QHash<Folder *, QPointer<EtagBatchJob>> _etagBatchJobs;
 
     /// Watches files that couldn't be synced due to locks
     QScopedPointer<LockWatcher> _lockWatcher;
@@ -322,6 +355,9 @@ private:
     /// Scheduled folders that should be synced as soon as possible
     QQueue<Folder *> _scheduledFolders;
 
+    /// The scheduled folders that have background priority
+    QSet<Folder *> _backgroundScheduledFolders;
+
     /// Picks the next scheduled folder and starts the sync
     QTimer _startScheduledSyncTimer;
 
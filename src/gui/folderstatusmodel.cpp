@@ -1093,9 +1093,9 @@ void FolderStatusModel::slotFolderSyncStateChange(Folder *f)
     } else if (state == SyncResult::NotYetStarted) {
         FolderMan *folderMan = FolderMan::instance();
         int pos = folderMan->scheduleQueue().indexOf(f);
-        if (folderMan->currentSyncFolder()
-            && folderMan->currentSyncFolder() != f) {
-            pos += 1;
+        pos += folderMan->currentSyncFolders().size();
+        if (folderMan->currentSyncFolders().contains(f)) {
+            pos -= 1;
         }
         QString message;
         if (pos <= 0) {
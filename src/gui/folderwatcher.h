@@ -85,6 +85,13 @@ public:
      */
     bool isReliable() const;
 
+    /**
+     * Folders whose subtrees are not watched, for example because the inotify
+     * watch limit was reached while registering them. Changes below them are
+     * only found by scanning.
+     */
+    QSet<QString> unwatchedPaths() const { return _unwatchedPaths; }
+
 signals:
     /** Emitted when one of the watched directories or one
      *  of the contained files is changed. */
@@ -94,9 +101,10 @@ signals:
      * Emitted if some notifications were lost.
      *
      * Would happen, for example, if the number of pending notifications
-     * exceeded the allocated buffer size on Windows. Note that the folder
-     * watcher could still be able to capture all future notifications -
-     * i.e. isReliable() is orthogonal to losing changes occasionally.
+     * exceeded the allocated buffer size on Windows or the inotify event
+     * queue on Linux. Note that the folder watcher could still be able to
+     * capture all future notifications - i.e. isReliable() is orthogonal to
+     * losing changes occasionally.
      */
     void lostChanges();
 
@@ -120,6 +128,7 @@ private:
     QSet<QString> _lastPaths;
     Folder *_folder;
     bool _isReliable = true;
+    QSet<QString> _unwatchedPaths;
 
     void appendSubPaths(QDir dir, QStringList& subPaths);
 
@@ -20,6 +20,7 @@
 #include "folderwatcher_linux.h"
 
 #include <cerrno>
+#include <QDirIterator>
 #include <QStringList>
 #include <QObject>
 #include <QVarLengthArray>
@@ -46,84 +47,101 @@ FolderWatcherPrivate::~FolderWatcherPrivate()
 {
 }
 
-// attention: result list passed by reference!
-bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullList)
+bool FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
 {
-    bool ok = true;
-    if (!(dir.exists() && dir.isReadable())) {
-        qCDebug(lcFolderWatcher) << "Non existing path coming in: " << dir.absolutePath();
-        ok = false;
-    } else {
-        QStringList nameFilter;
-        nameFilter << QLatin1String("*");
-        QDir::Filters filter = QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Hidden;
-        const QStringList pathes = dir.entryList(nameFilter, filter);
-
-        QStringList::const_iterator constIterator;
-        for (constIterator = pathes.constBegin(); constIterator != pathes.constEnd();
-             ++constIterator) {
-            const QString fullPath(dir.path() + QLatin1String("/") + (*constIterator));
-            fullList.append(fullPath);
-            ok = findFoldersBelow(QDir(fullPath), fullList);
-        }
-    }
-
-    return ok;
-}
-
-void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
-{
-    if (!path.isEmpty()) {
-        int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
-            IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
-        if (wd > -1) {
-            _watches.insert(wd, path);
-        } else {
-            // If we're running out of memory or inotify watches, become
-            // unreliable.
-            if (_parent->_isReliable && (errno == ENOMEM || errno == ENOSPC)) {
-                _parent->_isReliable = false;
-                emit _parent->becameUnreliable(
-                    tr("This problem usually happens when the inotify watches are exhausted. "
-                       "Check the FAQ for details."));
-            }
-        }
+    if (path.isEmpty())
+        return true;
+
+    int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
+        IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
+    if (wd > -1) {
+        // A directory that was moved keeps its watch descriptor
+        auto oldPath = _watches.value(wd);
+        if (!oldPath.isNull())
+            _watchesByPath.remove(oldPath);
+        _watches.insert(wd, path);
+        _watchesByPath.insert(path, wd);
+        return true;
     }
+    return errno != ENOMEM && errno != ENOSPC;
 }
 
 void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
 {
-    int subdirs = 0;
     qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
 
-    QDir inPath(path);
-    inotifyRegisterPath(inPath.absolutePath());
+    const QString folder = QDir(path).absolutePath();
+    if (!inotifyRegisterPath(folder)) {
+        watchesExhausted(folder);
+        return;
+    }
 
-    const QStringList watchedFolders = _watches.values();
+    // The subfolders are registered later, see slotRegisterPendingFolders()
+    _pendingFolders.enqueue(folder);
+    if (_pendingFolders.size() == 1)
+        QMetaObject::invokeMethod(this, "slotRegisterPendingFolders", Qt::QueuedConnection);
+}
 
-    QStringList allSubfolders;
-    if (!findFoldersBelow(QDir(path), allSubfolders)) {
-        qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
-    }
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        QDir folder(subfolder);
-        if (folder.exists() && !watchedFolders.contains(folder.absolutePath())) {
-            subdirs++;
+void FolderWatcherPrivate::slotRegisterPendingFolders()
+{
+    // Registering a large tree at once would block the event loop for long,
+    // so the subfolders are handled in batches. A folder is watched before
+    // its subfolders are listed: folders created in the meantime are either
+    // listed or reported by the watch of their parent.
+    static const int batchSize = 500;
+
+    int subdirs = 0;
+    while (!_pendingFolders.isEmpty() && subdirs < batchSize) {
+        const QString folder = _pendingFolders.dequeue();
+        QDirIterator it(folder, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Hidden);
+        while (it.hasNext()) {
+            const QString subfolder = it.next();
+            if (_watchesByPath.contains(subfolder))
+                continue;
             if (_parent->pathIsIgnored(subfolder)) {
-                qCDebug(lcFolderWatcher) << "* Not adding" << folder.path();
+                qCDebug(lcFolderWatcher) << "* Not adding" << subfolder;
                 continue;
             }
-            inotifyRegisterPath(folder.absolutePath());
-        } else {
-            qCDebug(lcFolderWatcher) << "    `-> discarded:" << folder.path();
+            if (!inotifyRegisterPath(subfolder)) {
+                // Some of the siblings may not be listed yet
+                watchesExhausted(folder);
+                return;
+            }
+            _pendingFolders.enqueue(subfolder);
+            ++subdirs;
         }
     }
 
     if (subdirs > 0) {
-        qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories";
+        qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories," << _watches.size() << "in total";
+    }
+    if (!_pendingFolders.isEmpty())
+        QMetaObject::invokeMethod(this, "slotRegisterPendingFolders", Qt::QueuedConnection);
+}
+
+void FolderWatcherPrivate::watchesExhausted(const QString &folder)
+{
+    if (_watches.isEmpty()) {
+        // Nothing is watched, we can't rely on the watcher at all
+        if (_parent->_isReliable) {
+            _parent->_isReliable = false;
+            emit _parent->becameUnreliable(
+                tr("This problem usually happens when the inotify watches are exhausted. "
+                   "Check the FAQ for details."));
+        }
+        _pendingFolders.clear();
+        return;
     }
+
+    // The rest of the tree is still watched. The subfolders of the folders
+    // that are left are scanned for changes by the syncs instead, see
+    // FolderWatcher::unwatchedPaths().
+    _parent->_unwatchedPaths.insert(folder);
+    while (!_pendingFolders.isEmpty())
+        _parent->_unwatchedPaths.insert(_pendingFolders.dequeue());
+    qCWarning(lcFolderWatcher) << "inotify watches exhausted after" << _watches.size() << "folders,"
+                               << _parent->_unwatchedPaths.size() << "folders are not watched."
+                               << "Consider raising /proc/sys/fs/inotify/max_user_watches";
 }
 
 void FolderWatcherPrivate::slotReceivedNotification(int fd)
@@ -166,6 +184,12 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             continue;
         }
 
+        if (event->mask & IN_Q_OVERFLOW) {
+            // The kernel dropped events, there is no telling for which paths
+            qCWarning(lcFolderWatcher) << "inotify event queue overflowed, changes were lost";
+            emit _parent->lostChanges();
+        }
+
         // Fire event for the path that was changed.
         if (event->len > 0 && event->wd > -1) {
             QByteArray fileName(event->name);
@@ -191,21 +215,14 @@ void FolderWatcherPrivate::addPath(const QString &path)
 
 void FolderWatcherPrivate::removePath(const QString &path)
 {
-    int wid = -1;
     // Remove the inotify watch.
-    QHash<int, QString>::const_iterator i = _watches.constBegin();
-
-    while (i != _watches.constEnd()) {
-        if (i.value() == path) {
-            wid = i.key();
-            break;
-        }
-        ++i;
-    }
-    if (wid > -1) {
-        inotify_rm_watch(_fd, wid);
-        _watches.remove(wid);
+    auto it = _watchesByPath.find(path);
+    if (it != _watchesByPath.end()) {
+        inotify_rm_watch(_fd, it.value());
+        _watches.remove(it.value());
+        _watchesByPath.erase(it);
     }
+    _parent->_unwatchedPaths.remove(path);
 }
 
 } // ns mirall
@@ -19,6 +19,7 @@
 #include <QString>
 #include <QSocketNotifier>
 #include <QHash>
+#include <QQueue>
 #include <QDir>
 
 #include "folderwatcher.h"
@@ -43,16 +44,23 @@ public:
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotRegisterPendingFolders();
 
 protected:
-    bool findFoldersBelow(const QDir &dir, QStringList &fullList);
-    void inotifyRegisterPath(const QString &path);
+    /// Returns false if the watches are exhausted
+    bool inotifyRegisterPath(const QString &path);
+    void watchesExhausted(const QString &folder);
 
 private:
     FolderWatcher *_parent;
 
     QString _folder;
     QHash<int, QString> _watches;
+    QHash<QString, int> _watchesByPath;
+
+    /// Watched folders whose subfolders still need to be registered
+    QQueue<QString> _pendingFolders;
+
     QScopedPointer<QSocketNotifier> _socket;
     int _fd;
 };
@@ -35,6 +35,7 @@
 #include <memory>
 #include "capabilities.h"
 #include "clientsideencryption.h"
+#include "concurrencycontroller.h"
 
 class QSettings;
 class QNetworkReply;
@@ -241,6 +242,14 @@ public:
 
     ClientSideEncryption* e2e();
 
+    /** The number of parallel jobs the last sync of the account settled on
+     * for a class of jobs, or 0 if no sync finished yet.
+     *
+     * Lets the next sync continue from there instead of ramping up again.
+     */
+    int learnedConcurrency(ConcurrencyController::JobClass jobClass) const { return _learnedConcurrency[jobClass]; }
+    void setLearnedConcurrency(ConcurrencyController::JobClass jobClass, int limit) { _learnedConcurrency[jobClass] = limit; }
+
     /// Used in RemoteWipe
     void retrieveAppPassword();
     void setAppPassword(QString appPassword);
@@ -319,6 +328,8 @@ private:
     QString _davPath; // defaults to value from theme, might be overwritten in brandings
     ClientSideEncryption _e2e;
 
+    int _learnedConcurrency[2] = { 0, 0 };
+
     friend class AccountManager;
 };
 }
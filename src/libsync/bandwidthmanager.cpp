@@ -29,6 +29,8 @@
 
 namespace OCC {
 
+QList<BandwidthManager *> BandwidthManager::s_managers;
+
 Q_LOGGING_CATEGORY(lcBandwidthManager, "nextcloud.sync.bandwidthmanager", QtInfoMsg)
 
 // Because of the many layers of buffering inside Qt (and probably the OS and the network)
@@ -37,12 +39,28 @@ Q_LOGGING_CATEGORY(lcBandwidthManager, "nextcloud.sync.bandwidthmanager", QtInfo
 static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000 * 2;
 // See also WritingState in http://code.woboq.org/qt5/qtbase/src/network/access/qhttpprotocolhandler.cpp.html#_ZN20QHttpProtocolHandler11sendRequestEv
 
+// How often the token buckets are refilled. Small steps keep the traffic
+// smooth instead of saturating the link at the start of every second.
+static qint64 absoluteLimitTimerIntervalMsec = 100;
+
+// The token buckets hold at most this much worth of the rate, which bounds
+// the bursts after the transfers were idle.
+static qint64 maximumBurstMsec = 250;
+
+// Weight of a new measurement of the full speed for relative limits
+static double relativeLimitSmoothingFactor = 0.5;
+
 // FIXME At some point:
 //  * Register device only after the QNR received its metaDataChanged() signal
-//  * Incorporate Qt buffer fill state (it's a negative absolute delta).
 //  * Incorporate SSL overhead (percentage)
 //  * For relative limiting, do less measuring and more delaying+giving quota
-//  * For relative limiting, smoothen measurements
+
+static double smoothenSpeed(double previous, double measured)
+{
+    if (previous <= 0)
+        return measured;
+    return relativeLimitSmoothingFactor * measured + (1 - relativeLimitSmoothingFactor) * previous;
+}
 
 BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     : QObject()
@@ -50,20 +68,26 @@ BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     , _relativeLimitCurrentMeasuredDevice(nullptr)
     , _relativeUploadLimitProgressAtMeasuringRestart(0)
     , _currentUploadLimit(0)
+    , _uploadTokens(0)
+    , _relativeUploadSpeed(0)
+    , _relativeUploadRate(0)
     , _relativeLimitCurrentMeasuredJob(nullptr)
     , _currentDownloadLimit(0)
+    , _downloadTokens(0)
+    , _relativeDownloadSpeed(0)
+    , _relativeDownloadRate(0)
 {
     _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
     _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
 
     QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
-    _switchingTimer.setInterval(10 * 1000);
+    _switchingTimer.setInterval(1000);
     _switchingTimer.start();
     QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
 
     // absolute uploads/downloads
     QObject::connect(&_absoluteLimitTimer, &QTimer::timeout, this, &BandwidthManager::absoluteLimitTimerExpired);
-    _absoluteLimitTimer.setInterval(1000);
+    _absoluteLimitTimer.setInterval(absoluteLimitTimerIntervalMsec);
     _absoluteLimitTimer.start();
 
     // Relative uploads
@@ -85,10 +109,13 @@ BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     QObject::connect(&_relativeDownloadDelayTimer, &QTimer::timeout,
         this, &BandwidthManager::relativeDownloadDelayTimerExpired);
     _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
+
+    s_managers.append(this);
 }
 
 BandwidthManager::~BandwidthManager()
 {
+    s_managers.removeAll(this);
 }
 
 void BandwidthManager::registerUploadDevice(UploadDevice *p)
@@ -164,14 +191,16 @@ void BandwidthManager::relativeUploadMeasuringTimerExpired()
 
     qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting Delay";
 
-    qint64 relativeLimitProgressMeasured = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                               + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
+    // Only count what Qt reported as sent: the data it read ahead sits in its
+    // buffers and would make the link look faster than it is.
+    qint64 relativeLimitProgressMeasured = _relativeLimitCurrentMeasuredDevice->_readWithProgress;
     qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeUploadLimitProgressAtMeasuringRestart;
     qCDebug(lcBandwidthManager) << _relativeUploadLimitProgressAtMeasuringRestart
                                 << relativeLimitProgressMeasured << relativeLimitProgressDifference;
 
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
+    _relativeUploadSpeed = smoothenSpeed(_relativeUploadSpeed,
+        relativeLimitProgressDifference * 1000.0 / relativeLimitMeasuringTimerIntervalMsec);
+    qint64 speedkBPerSec = _relativeUploadSpeed / 1024.0;
     qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
                                 << _relativeLimitCurrentMeasuredDevice->_readWithProgress << _relativeLimitCurrentMeasuredDevice->_read
                                 << qAbs(_relativeLimitCurrentMeasuredDevice->_readWithProgress
@@ -193,13 +222,15 @@ void BandwidthManager::relativeUploadMeasuringTimerExpired()
     _relativeUploadDelayTimer.setInterval(realWaitTimeMsec);
     _relativeUploadDelayTimer.start();
 
-    int deviceCount = _relativeUploadDeviceList.count();
-    qint64 quotaPerDevice = relativeLimitProgressDifference * (uploadLimitPercent / 100.0) / deviceCount + 1.0;
+    // The quota is paced out over the delay by absoluteLimitTimerExpired()
+    // rather than handed out at once
+    qint64 quota = _relativeUploadSpeed * relativeLimitMeasuringTimerIntervalMsec / 1000 * (uploadLimitPercent / 100.0);
+    _relativeUploadRate = quota * 1000 / realWaitTimeMsec + 1;
+    _uploadTokens = 0;
+    qCDebug(lcBandwidthManager) << "Pacing" << _relativeUploadRate / 1024.0 << "kB/sec until the next measurement";
     Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
         ud->setBandwidthLimited(true);
         ud->setChoked(false);
-        ud->giveBandwidthQuota(quotaPerDevice);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerDevice / 1024.0 << "kB to" << ud;
     }
     _relativeLimitCurrentMeasuredDevice = nullptr;
 }
@@ -218,14 +249,13 @@ void BandwidthManager::relativeUploadDelayTimerExpired()
     }
 
     qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting measuring";
+    _relativeUploadRate = 0;
 
     // Take first device and then append it again (= we round robin all devices)
     _relativeLimitCurrentMeasuredDevice = _relativeUploadDeviceList.takeFirst();
     _relativeUploadDeviceList.append(_relativeLimitCurrentMeasuredDevice);
 
-    _relativeUploadLimitProgressAtMeasuringRestart = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                                         + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
+    _relativeUploadLimitProgressAtMeasuringRestart = _relativeLimitCurrentMeasuredDevice->_readWithProgress;
     _relativeLimitCurrentMeasuredDevice->setBandwidthLimited(false);
     _relativeLimitCurrentMeasuredDevice->setChoked(false);
 
@@ -263,7 +293,9 @@ void BandwidthManager::relativeDownloadMeasuringTimerExpired()
     qCDebug(lcBandwidthManager) << _relativeDownloadLimitProgressAtMeasuringRestart
                                 << relativeLimitProgressMeasured << relativeLimitProgressDifference;
 
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
+    _relativeDownloadSpeed = smoothenSpeed(_relativeDownloadSpeed,
+        relativeLimitProgressDifference * 1000.0 / relativeLimitMeasuringTimerIntervalMsec);
+    qint64 speedkBPerSec = _relativeDownloadSpeed / 1024.0;
     qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
                                 << _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
 
@@ -282,20 +314,21 @@ void BandwidthManager::relativeDownloadMeasuringTimerExpired()
     _relativeDownloadDelayTimer.setInterval(realWaitTimeMsec);
     _relativeDownloadDelayTimer.start();
 
-    int jobCount = _downloadJobList.count();
-    qint64 quota = relativeLimitProgressDifference * (downloadLimitPercent / 100.0);
+    qint64 quota = _relativeDownloadSpeed * relativeLimitMeasuringTimerIntervalMsec / 1000 * (downloadLimitPercent / 100.0);
     if (quota > 20 * 1024) {
         qCInfo(lcBandwidthManager) << "ADJUSTING QUOTA FROM " << quota << " TO " << quota - 20 * 1024;
         quota -= 20 * 1024;
     }
-    qint64 quotaPerJob = quota / jobCount + 1.0;
+    // The quota is paced out over the delay by absoluteLimitTimerExpired()
+    // rather than handed out at once
+    _relativeDownloadRate = quota * 1000 / realWaitTimeMsec + 1;
+    _downloadTokens = 0;
+    qCDebug(lcBandwidthManager) << "Pacing" << _relativeDownloadRate / 1024.0 << "kB/sec until the next measurement";
     Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
         gfj->setBandwidthLimited(true);
         gfj->setChoked(false);
-        gfj->giveBandwidthQuota(quotaPerJob);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerJob / 1024.0 << "kB to" << gfj;
     }
-    _relativeLimitCurrentMeasuredDevice = nullptr;
+    _relativeLimitCurrentMeasuredJob = nullptr;
 }
 
 void BandwidthManager::relativeDownloadDelayTimerExpired()
@@ -313,6 +346,7 @@ void BandwidthManager::relativeDownloadDelayTimerExpired()
     }
 
     qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting measuring";
+    _relativeDownloadRate = 0;
 
     // Take first device and then append it again (= we round robin all devices)
     _relativeLimitCurrentMeasuredJob = _downloadJobList.takeFirst();
@@ -341,6 +375,9 @@ void BandwidthManager::switchingTimerExpired()
     if (newUploadLimit != _currentUploadLimit) {
         qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
         _currentUploadLimit = newUploadLimit;
+        _uploadTokens = 0;
+        _relativeUploadSpeed = 0;
+        _relativeUploadRate = 0;
         Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
             if (newUploadLimit == 0) {
                 ud->setBandwidthLimited(false);
@@ -358,6 +395,9 @@ void BandwidthManager::switchingTimerExpired()
     if (newDownloadLimit != _currentDownloadLimit) {
         qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
         _currentDownloadLimit = newDownloadLimit;
+        _downloadTokens = 0;
+        _relativeDownloadSpeed = 0;
+        _relativeDownloadRate = 0;
         Q_FOREACH (GETFileJob *j, _downloadJobList) {
             if (usingAbsoluteDownloadLimit()) {
                 j->setBandwidthLimited(true);
@@ -373,23 +413,59 @@ void BandwidthManager::switchingTimerExpired()
     }
 }
 
+/*
+ * Refills the token bucket of one direction and splits its content evenly
+ * between the transfers.
+ *
+ * Quota a transfer didn't use since the last refill (because it was waiting
+ * for the server or just finished) goes back into the bucket, so the busy
+ * transfers together still reach the configured rate. The bucket is small,
+ * so idle periods don't turn into bursts that starve other traffic on the link.
+ */
+template <typename T>
+static void refillAndDistribute(const QLinkedList<T *> &consumers, qint64 rate, qint64 &tokens)
+{
+    for (T *consumer : consumers)
+        tokens += consumer->bandwidthQuota();
+    const qint64 capacity = qMax<qint64>(consumers.count(), rate * maximumBurstMsec / 1000);
+    tokens = qMin(tokens + rate * absoluteLimitTimerIntervalMsec / 1000, capacity);
+
+    const qint64 share = tokens / consumers.count();
+    tokens -= share * consumers.count();
+    for (T *consumer : consumers)
+        consumer->giveBandwidthQuota(share);
+}
+
+// Paces the absolute limits, and the relative limits between measurements
 void BandwidthManager::absoluteLimitTimerExpired()
 {
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-        qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.count() << _currentUploadLimit;
-        Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
+    // The relative rates are zero unless a relative limit is in its delay phase
+    qint64 uploadRate = usingAbsoluteUploadLimit() ? _currentUploadLimit : _relativeUploadRate;
+    if (uploadRate > 0 && !_absoluteUploadDeviceList.isEmpty()) {
+        if (usingAbsoluteUploadLimit()) {
+            // The limit is global: concurrent syncs get a share in
+            // proportion to their transfers
+            int allUploads = 0;
+            for (auto manager : s_managers) {
+                if (manager->usingAbsoluteUploadLimit())
+                    allUploads += manager->_absoluteUploadDeviceList.count();
+            }
+            uploadRate = uploadRate * _absoluteUploadDeviceList.count() / qMax(1, allUploads);
         }
+        refillAndDistribute(_absoluteUploadDeviceList, uploadRate, _uploadTokens);
     }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-        qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.count() << _currentDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
+
+    qint64 downloadRate = usingAbsoluteDownloadLimit() ? _currentDownloadLimit : _relativeDownloadRate;
+    if (downloadRate > 0 && !_downloadJobList.isEmpty()) {
+        if (usingAbsoluteDownloadLimit()) {
+            int allDownloads = 0;
+            for (auto manager : s_managers) {
+                if (manager->usingAbsoluteDownloadLimit())
+                    allDownloads += manager->_downloadJobList.count();
+            }
+            downloadRate = downloadRate * _downloadJobList.count() / qMax(1, allDownloads);
         }
+        refillAndDistribute(_downloadJobList, downloadRate, _downloadTokens);
     }
 }
 }
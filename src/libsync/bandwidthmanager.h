@@ -17,6 +17,7 @@
 
 #include <QObject>
 #include <QLinkedList>
+#include <QList>
 #include <QTimer>
 #include <QIODevice>
 
@@ -86,6 +87,15 @@ private:
     qint64 _relativeUploadLimitProgressAtMeasuringRestart;
     qint64 _currentUploadLimit;
 
+    // token bucket for the upload limit
+    qint64 _uploadTokens;
+
+    // smoothed full speed measured for the relative limit, in bytes per second
+    double _relativeUploadSpeed;
+
+    // rate paced out until the next measurement for the relative limit
+    qint64 _relativeUploadRate;
+
     QLinkedList<GETFileJob *> _downloadJobList;
     QTimer _relativeDownloadMeasuringTimer;
 
@@ -99,6 +109,18 @@ private:
     qint64 _relativeDownloadLimitProgressAtMeasuringRestart;
 
     qint64 _currentDownloadLimit;
+
+    // token bucket for the download limit
+    qint64 _downloadTokens;
+
+    // smoothed full speed measured for the relative limit, in bytes per second
+    double _relativeDownloadSpeed;
+
+    // rate paced out until the next measurement for the relative limit
+    qint64 _relativeDownloadRate;
+
+    // the managers of all running syncs, which share the absolute limits
+    static QList<BandwidthManager *> s_managers;
 };
 }
 
@@ -15,6 +15,7 @@
 #include "creds/abstractcredentials.h"
 
 #include <map>
+#include <memory>
 
 #include <cstdio>
 
@@ -30,6 +31,7 @@
 #include <QLineEdit>
 #include <QIODevice>
 #include <QUuid>
+#include <QThreadPool>
 
 #include <keychain.h>
 #include "common/utility.h"
@@ -1370,87 +1372,107 @@ bool ClientSideEncryption::isFolderEncrypted(const QString& path) const {
   return (*it);
 }
 
+namespace {
+    // Files are processed in blocks of this size, a multiple of the AES block size
+    const qint64 fileCryptoBlockSize = 1024 * 1024;
+
+    // The size of the GCM authentication tag appended to encrypted files
+    const int fileCryptoTagSize = 16;
+
+    struct CipherCtxDeleter
+    {
+        void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+    };
+    using CipherCtxPointer = std::unique_ptr<EVP_CIPHER_CTX, CipherCtxDeleter>;
+
+    bool writeAll(QFile *output, const char *data, qint64 size)
+    {
+        if (output->write(data, size) != size) {
+            qCInfo(lcCse()) << "Could not write to" << output->fileName() << output->errorString();
+            return false;
+        }
+        return true;
+    }
+}
+
 bool EncryptionHelper::fileEncryption(const QByteArray &key, const QByteArray &iv, QFile *input, QFile *output, QByteArray& returnTag)
 {
     if (!input->open(QIODevice::ReadOnly)) {
-      qCDebug(lcCse) << "Could not open input file for reading" << input->errorString();
+        qCInfo(lcCse) << "Could not open input file for reading" << input->errorString();
+        return false;
     }
     if (!output->open(QIODevice::WriteOnly)) {
-      qCDebug(lcCse) << "Could not oppen output file for writting" << output->errorString();
+        qCInfo(lcCse) << "Could not open output file for writing" << output->errorString();
+        return false;
     }
 
-    // Init
-    EVP_CIPHER_CTX *ctx;
-
     /* Create and initialise the context */
-    if(!(ctx = EVP_CIPHER_CTX_new())) {
+    CipherCtxPointer ctx(EVP_CIPHER_CTX_new());
+    if (!ctx) {
         qCInfo(lcCse()) << "Could not create context";
         return false;
     }
 
-    /* Initialise the decryption operation. */
-    if(!EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
+    /* Initialise the encryption operation. */
+    if(!EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
         qCInfo(lcCse()) << "Could not init cipher";
         return false;
     }
 
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
 
     /* Set IV length. */
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, iv.size(), nullptr)) {
+    if(!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, iv.size(), nullptr)) {
         qCInfo(lcCse()) << "Could not set iv length";
         return false;
     }
 
     /* Initialise key and IV */
-    if(!EVP_EncryptInit_ex(ctx, nullptr, nullptr, (const unsigned char *)key.constData(), (const unsigned char *)iv.constData())) {
+    if(!EVP_EncryptInit_ex(ctx.get(), nullptr, nullptr, (const unsigned char *)key.constData(), (const unsigned char *)iv.constData())) {
         qCInfo(lcCse()) << "Could not set key and iv";
         return false;
     }
 
-    unsigned char *out = (unsigned char *)malloc(sizeof(unsigned char) * (1024 + 16 -1));
+    // Both buffers are reused for every block, GCM output is as long as its input
+    QByteArray data(fileCryptoBlockSize, Qt::Uninitialized);
+    QByteArray out(fileCryptoBlockSize + fileCryptoTagSize, Qt::Uninitialized);
+    auto outData = reinterpret_cast<unsigned char *>(out.data());
     int len = 0;
-    int total_len = 0;
 
-    qCDebug(lcCse) << "Starting to encrypt the file" << input->fileName() << input->atEnd();
-    while(!input->atEnd()) {
-        QByteArray data = input->read(1024);
-
-        if (data.size() == 0) {
-            qCInfo(lcCse()) << "Could not read data from file";
+    qCDebug(lcCse) << "Starting to encrypt the file" << input->fileName();
+    while (!input->atEnd()) {
+        const qint64 read = input->read(data.data(), fileCryptoBlockSize);
+        if (read <= 0) {
+            qCInfo(lcCse()) << "Could not read data from file" << input->errorString();
             return false;
         }
 
-        qCDebug(lcCse) << "Encrypting " << data;
-        if(!EVP_EncryptUpdate(ctx, out, &len, (unsigned char *)data.constData(), data.size())) {
+        if(!EVP_EncryptUpdate(ctx.get(), outData, &len, (const unsigned char *)data.constData(), read)) {
             qCInfo(lcCse()) << "Could not encrypt";
             return false;
         }
 
-        output->write((char *)out, len);
-        total_len += len;
+        if (!writeAll(output, out.constData(), len))
+            return false;
     }
 
-    if(1 != EVP_EncryptFinal_ex(ctx, out, &len)) {
+    if(1 != EVP_EncryptFinal_ex(ctx.get(), outData, &len)) {
         qCInfo(lcCse()) << "Could finalize encryption";
         return false;
     }
-    output->write((char *)out, len);
-    total_len += len;
+    if (!writeAll(output, out.constData(), len))
+        return false;
 
     /* Get the tag */
-    unsigned char *tag = (unsigned char *)malloc(sizeof(unsigned char) * 16);
-    if(1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag)) {
+    QByteArray tag(fileCryptoTagSize, Qt::Uninitialized);
+    if(1 != EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, fileCryptoTagSize, tag.data())) {
         qCInfo(lcCse()) << "Could not get tag";
         return false;
     }
 
-    returnTag = QByteArray((const char*) tag, 16);
-    output->write((char *)tag, 16);
-
-    free(out);
-    free(tag);
-    EVP_CIPHER_CTX_free(ctx);
+    returnTag = tag;
+    if (!writeAll(output, tag.constData(), tag.size()))
+        return false;
 
     input->close();
     output->close();
@@ -1461,85 +1483,141 @@ bool EncryptionHelper::fileEncryption(const QByteArray &key, const QByteArray &i
 bool EncryptionHelper::fileDecryption(const QByteArray &key, const QByteArray& iv,
                                QFile *input, QFile *output)
 {
-    input->open(QIODevice::ReadOnly);
-    output->open(QIODevice::WriteOnly);
+    if (!input->open(QIODevice::ReadOnly)) {
+        qCInfo(lcCse) << "Could not open input file for reading" << input->errorString();
+        return false;
+    }
+    if (!output->open(QIODevice::WriteOnly)) {
+        qCInfo(lcCse) << "Could not open output file for writing" << output->errorString();
+        return false;
+    }
 
-    // Init
-    EVP_CIPHER_CTX *ctx;
+    const qint64 size = input->size() - fileCryptoTagSize;
+    if (size < 0) {
+        qCInfo(lcCse()) << "The encrypted file is too short";
+        return false;
+    }
 
     /* Create and initialise the context */
-    if(!(ctx = EVP_CIPHER_CTX_new())) {
+    CipherCtxPointer ctx(EVP_CIPHER_CTX_new());
+    if (!ctx) {
         qCInfo(lcCse()) << "Could not create context";
         return false;
     }
 
     /* Initialise the decryption operation. */
-    if(!EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
+    if(!EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
         qCInfo(lcCse()) << "Could not init cipher";
         return false;
     }
 
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
 
     /* Set IV length. */
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN,  iv.size(), nullptr)) {
+    if(!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN,  iv.size(), nullptr)) {
         qCInfo(lcCse()) << "Could not set iv length";
         return false;
     }
 
     /* Initialise key and IV */
-    if(!EVP_DecryptInit_ex(ctx, nullptr, nullptr, (const unsigned char *) key.constData(), (const unsigned char *) iv.constData())) {
+    if(!EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, (const unsigned char *) key.constData(), (const unsigned char *) iv.constData())) {
         qCInfo(lcCse()) << "Could not set key and iv";
         return false;
     }
 
-    qint64 size = input->size() - 16;
-
-    unsigned char *out = (unsigned char *)malloc(sizeof(unsigned char) * (1024 + 16 -1));
+    // Both buffers are reused for every block, GCM output is as long as its input
+    QByteArray data(fileCryptoBlockSize, Qt::Uninitialized);
+    QByteArray out(fileCryptoBlockSize + fileCryptoTagSize, Qt::Uninitialized);
+    auto outData = reinterpret_cast<unsigned char *>(out.data());
     int len = 0;
 
-    while(input->pos() < size) {
-
-        int toRead = size - input->pos();
-        if (toRead > 1024) {
-            toRead = 1024;
-        }
-
-        QByteArray data = input->read(toRead);
-
-        if (data.size() == 0) {
-            qCInfo(lcCse()) << "Could not read data from file";
+    while (input->pos() < size) {
+        const qint64 toRead = qMin(size - input->pos(), fileCryptoBlockSize);
+        const qint64 read = input->read(data.data(), toRead);
+        if (read <= 0) {
+            qCInfo(lcCse()) << "Could not read data from file" << input->errorString();
             return false;
         }
 
-        if(!EVP_DecryptUpdate(ctx, out, &len, (unsigned char *)data.constData(), data.size())) {
+        if(!EVP_DecryptUpdate(ctx.get(), outData, &len, (const unsigned char *)data.constData(), read)) {
             qCInfo(lcCse()) << "Could not decrypt";
             return false;
         }
 
-        output->write((char *)out, len);
+        if (!writeAll(output, out.constData(), len))
+            return false;
     }
 
-    QByteArray tag = input->read(16);
+    QByteArray tag = input->read(fileCryptoTagSize);
 
     /* Set expected tag value. Works in OpenSSL 1.0.1d and later */
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag.size(), (unsigned char *)tag.constData())) {
+    if(!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, tag.size(), (unsigned char *)tag.data())) {
         qCInfo(lcCse()) << "Could not set expected tag";
         return false;
     }
 
-    if(1 != EVP_DecryptFinal_ex(ctx, out, &len)) {
+    if(1 != EVP_DecryptFinal_ex(ctx.get(), outData, &len)) {
         qCInfo(lcCse()) << "Could finalize decryption";
         return false;
     }
-    output->write((char *)out, len);
-
-    free(out);
-    EVP_CIPHER_CTX_free(ctx);
+    if (!writeAll(output, out.constData(), len))
+        return false;
 
     input->close();
     output->close();
     return true;
 }
 
+FileEncryptionJob::FileEncryptionJob(Mode mode, const QByteArray &key, const QByteArray &iv,
+    const QString &inputPath, const QString &outputPath, QObject *parent)
+    : QObject(parent)
+    , _mode(mode)
+    , _key(key)
+    , _iv(iv)
+    , _inputPath(inputPath)
+    , _outputPath(outputPath)
+{
+    connect(&_watcher, &QFutureWatcherBase::finished, this, &FileEncryptionJob::slotFinished);
+}
+
+void FileEncryptionJob::start()
+{
+    qCDebug(lcCse) << "Starting to" << (_mode == Encrypt ? "encrypt" : "decrypt") << _inputPath;
+
+    QFutureInterface<QPair<bool, QByteArray>> result;
+    result.reportStarted();
+    _watcher.setFuture(result.future());
+    QThreadPool::globalInstance()->start(new Worker(*this, result));
+}
+
+FileEncryptionJob::Worker::Worker(const FileEncryptionJob &job, const QFutureInterface<QPair<bool, QByteArray>> &result)
+    : _mode(job._mode)
+    , _key(job._key)
+    , _iv(job._iv)
+    , _inputPath(job._inputPath)
+    , _outputPath(job._outputPath)
+    , _result(result)
+{
+}
+
+void FileEncryptionJob::Worker::run()
+{
+    // The files are only touched by the worker thread
+    QFile input(_inputPath);
+    QFile output(_outputPath);
+    QByteArray tag;
+    const bool success = _mode == Encrypt
+        ? EncryptionHelper::fileEncryption(_key, _iv, &input, &output, tag)
+        : EncryptionHelper::fileDecryption(_key, _iv, &input, &output);
+    _result.reportResult(qMakePair(success, tag));
+    _result.reportFinished();
+}
+
+void FileEncryptionJob::slotFinished()
+{
+    const auto result = _watcher.future().result();
+    _tag = result.second;
+    emit finished(result.first);
+}
+
 }
@@ -9,6 +9,9 @@
 #include <QFile>
 #include <QVector>
 #include <QMap>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QRunnable>
 
 #include <openssl/evp.h>
 
@@ -27,7 +30,7 @@ QString baseUrl();
 
 namespace EncryptionHelper {
     QByteArray generateRandomFilename();
-    QByteArray generateRandom(int size);
+    OWNCLOUDSYNC_EXPORT QByteArray generateRandom(int size);
     QByteArray generatePassword(const QString &wordlist, const QByteArray& salt);
     QByteArray encryptPrivateKey(
             const QByteArray& key,
@@ -59,13 +62,69 @@ namespace EncryptionHelper {
             const QByteArray& data
     );
 
-    bool fileEncryption(const QByteArray &key, const QByteArray &iv,
+    OWNCLOUDSYNC_EXPORT bool fileEncryption(const QByteArray &key, const QByteArray &iv,
                       QFile *input, QFile *output, QByteArray& returnTag);
 
-    bool fileDecryption(const QByteArray &key, const QByteArray& iv,
+    OWNCLOUDSYNC_EXPORT bool fileDecryption(const QByteArray &key, const QByteArray& iv,
                                QFile *input, QFile *output);
 }
 
+/**
+ * @brief Encrypts or decrypts a file into another file in a worker thread
+ * @ingroup libsync
+ *
+ * Uses EncryptionHelper::fileEncryption() and fileDecryption() on the
+ * global thread pool so large files don't block the main thread.
+ * Emits finished() once done; tag() has the authentication tag of an
+ * encrypted file afterwards.
+ */
+class OWNCLOUDSYNC_EXPORT FileEncryptionJob : public QObject
+{
+    Q_OBJECT
+public:
+    enum Mode {
+        Encrypt,
+        Decrypt
+    };
+
+    FileEncryptionJob(Mode mode, const QByteArray &key, const QByteArray &iv,
+        const QString &inputPath, const QString &outputPath, QObject *parent = nullptr);
+
+    void start();
+
+    QByteArray tag() const { return _tag; }
+
+signals:
+    void finished(bool success);
+
+private slots:
+    void slotFinished();
+
+private:
+    class Worker : public QRunnable
+    {
+    public:
+        Worker(const FileEncryptionJob &job, const QFutureInterface<QPair<bool, QByteArray>> &result);
+        void run() override;
+
+    private:
+        Mode _mode;
+        QByteArray _key;
+        QByteArray _iv;
+        QString _inputPath;
+        QString _outputPath;
+        QFutureInterface<QPair<bool, QByteArray>> _result;
+    };
+
+    Mode _mode;
+    QByteArray _key;
+    QByteArray _iv;
+    QString _inputPath;
+    QString _outputPath;
+    QByteArray _tag;
+    QFutureWatcher<QPair<bool, QByteArray>> _watcher;
+};
+
 class OWNCLOUDSYNC_EXPORT ClientSideEncryption : public QObject {
     Q_OBJECT
 public:
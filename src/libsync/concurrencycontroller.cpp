@@ -0,0 +1,147 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "concurrencycontroller.h"
+
+#include <QLoggingCategory>
+#include <QtMath>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcConcurrency, "nextcloud.sync.propagator.concurrency", QtInfoMsg)
+
+// A window needs at least this many finished jobs to be meaningful
+static const int minimumJobsPerWindow = 4;
+
+// Quick jobs taking this much longer than the best average seen means the
+// requests are queueing somewhere
+static const int durationInflationFactor = 4;
+
+static const char *className(ConcurrencyController::JobClass jobClass)
+{
+    return jobClass == ConcurrencyController::Transfer ? "transfer" : "quick";
+}
+
+ConcurrencyController::ConcurrencyController()
+{
+    _timer.start();
+}
+
+void ConcurrencyController::setLimits(JobClass jobClass, int minimum, int initial, int maximum)
+{
+    State &state = _states[jobClass];
+    state = State();
+    state.minimum = qMax(1, minimum);
+    state.maximum = qMax(state.minimum, maximum);
+    state.limit = qBound(state.minimum, initial, state.maximum);
+}
+
+int ConcurrencyController::limit(JobClass jobClass) const
+{
+    return qFloor(_states[jobClass].limit);
+}
+
+void ConcurrencyController::jobFinished(JobClass jobClass, qint64 bytes, qint64 durationMsecs, bool overloaded)
+{
+    State &state = _states[jobClass];
+    const qint64 now = _clock ? _clock() : _timer.elapsed();
+    if (state.windowStart < 0)
+        state.windowStart = now;
+
+    if (overloaded) {
+        // Back off right away, but only once per window: the jobs that
+        // fail together were all started under the old limit.
+        if (state.overloads == 0) {
+            const int before = limit(jobClass);
+            state.limit = qMax<double>(state.minimum, state.limit / 2);
+            qCInfo(lcConcurrency) << "Server overloaded, reducing" << className(jobClass)
+                                  << "jobs from" << before << "to" << limit(jobClass);
+        }
+        ++state.overloads;
+    } else {
+        ++state.jobs;
+        state.bytes += bytes;
+        state.durationSum += durationMsecs;
+    }
+
+    if (state.jobs + state.overloads >= qMax(minimumJobsPerWindow, limit(jobClass))
+        && now - state.windowStart >= windowMsecs) {
+        evaluate(jobClass, state, now);
+    }
+}
+
+void ConcurrencyController::bytesTransferred(JobClass jobClass, qint64 bytes)
+{
+    State &state = _states[jobClass];
+    if (state.windowStart < 0)
+        state.windowStart = _clock ? _clock() : _timer.elapsed();
+    state.bytes += bytes;
+}
+
+void ConcurrencyController::evaluate(JobClass jobClass, State &state, qint64 now)
+{
+    const int before = limit(jobClass);
+    const qint64 elapsed = qMax<qint64>(1, now - state.windowStart);
+    const double throughput = (jobClass == Transfer ? state.bytes : state.jobs) * 1000. / elapsed;
+    const qint64 averageDuration = state.jobs > 0 ? state.durationSum / state.jobs : -1;
+
+    const char *reason = nullptr;
+    if (state.overloads > 0) {
+        // Already reduced when the overload was seen
+    } else if (jobClass == Quick && averageDuration >= 0 && state.bestAverageDuration > 0
+        && averageDuration > durationInflationFactor * state.bestAverageDuration) {
+        state.limit -= 1;
+        reason = "job duration increased";
+    } else if (state.lastThroughput <= 0 || throughput > state.lastThroughput * 1.05) {
+        state.limit += 1;
+        reason = "throughput increased";
+    } else if (throughput < state.lastThroughput * 0.9) {
+        state.limit -= 1;
+        reason = "throughput decreased";
+    }
+    state.limit = qBound<double>(state.minimum, state.limit, state.maximum);
+
+    if (averageDuration > 0 && (state.bestAverageDuration < 0 || averageDuration < state.bestAverageDuration))
+        state.bestAverageDuration = averageDuration;
+    state.lastThroughput = throughput;
+
+    if (reason && limit(jobClass) != before) {
+        qCInfo(lcConcurrency) << "Changed parallel" << className(jobClass) << "jobs from" << before
+                              << "to" << limit(jobClass) << "because" << reason << "-" << status();
+    }
+
+    state.windowStart = now;
+    state.jobs = 0;
+    state.overloads = 0;
+    state.bytes = 0;
+    state.durationSum = 0;
+}
+
+QString ConcurrencyController::status() const
+{
+    QString result;
+    for (auto jobClass : { Transfer, Quick }) {
+        const State &state = _states[jobClass];
+        if (!result.isEmpty())
+            result += QLatin1String("; ");
+        result += QStringLiteral("%1: limit %2 (%3-%4), last throughput %5%6/s, best average duration %7 ms")
+                      .arg(QLatin1String(className(jobClass)))
+                      .arg(limit(jobClass))
+                      .arg(state.minimum)
+                      .arg(state.maximum)
+                      .arg(qRound64(state.lastThroughput))
+                      .arg(jobClass == Transfer ? QLatin1String(" bytes") : QLatin1String(" jobs"))
+                      .arg(state.bestAverageDuration);
+    }
+    return result;
+}
+}
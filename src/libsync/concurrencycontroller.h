@@ -0,0 +1,108 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QElapsedTimer>
+#include <QString>
+
+#include <functional>
+
+namespace OCC {
+
+/**
+ * @brief Decides how many propagation jobs may run in parallel
+ * @ingroup libsync
+ *
+ * Keeps a separate limit for bulk transfers and for jobs that are likely
+ * to finish quickly (small files and metadata operations). The limits are
+ * adjusted AIMD-style from the jobs that finish:
+ *
+ * - Once enough jobs finished in a measuring window, the throughput of
+ *   the window (bytes per second for transfers, jobs per second for quick
+ *   jobs) is compared to the previous window. Bytes count when they are
+ *   transferred, not when the file is complete.
+ * - If the server signals overload (5xx, 429, timeouts), the limit is halved.
+ * - If the average job duration grew far beyond the best one seen, the
+ *   server or link is queueing requests and the limit is decreased by one.
+ * - If the throughput did not get worse, the limit is increased by one,
+ *   otherwise it is decreased by one.
+ */
+class OWNCLOUDSYNC_EXPORT ConcurrencyController
+{
+public:
+    enum JobClass {
+        Transfer,
+        Quick,
+    };
+
+    ConcurrencyController();
+
+    /** Sets the bounds and the starting point for one class of jobs. */
+    void setLimits(JobClass jobClass, int minimum, int initial, int maximum);
+
+    /** The number of jobs of the class that may currently run in parallel. */
+    int limit(JobClass jobClass) const;
+
+    /**
+     * Feeds a finished job into the controller.
+     *
+     * \a overloaded is set when the job failed in a way that suggests the
+     * server or the network can't keep up.
+     */
+    void jobFinished(JobClass jobClass, qint64 bytes, qint64 durationMsecs, bool overloaded);
+
+    /**
+     * Credits bytes moved by jobs that are still running to the current window.
+     *
+     * Otherwise a file's bytes only count once it is complete and the
+     * throughput of a window depends on how many large files happened to
+     * finish in it.
+     */
+    void bytesTransferred(JobClass jobClass, qint64 bytes);
+
+    /** Current limits and measurements, for the logs. */
+    QString status() const;
+
+    /** Replaces the clock used to measure the windows, for tests. */
+    void setClock(const std::function<qint64()> &clock) { _clock = clock; }
+
+    /** Minimum length of a measuring window. */
+    static const qint64 windowMsecs = 2000;
+
+private:
+    struct State
+    {
+        double limit = 1;
+        int minimum = 1;
+        int maximum = 1;
+
+        // Current measuring window
+        qint64 windowStart = -1;
+        int jobs = 0;
+        int overloads = 0;
+        qint64 bytes = 0;
+        qint64 durationSum = 0;
+
+        double lastThroughput = 0;
+        qint64 bestAverageDuration = -1;
+    };
+
+    void evaluate(JobClass jobClass, State &state, qint64 now);
+
+    State _states[2];
+    QElapsedTimer _timer;
+    std::function<qint64()> _clock; // _timer is used if not set
+};
+}
@@ -92,6 +92,7 @@ static const char newBigFolderSizeLimitC[] = "newBigFolderSizeLimit";
 static const char useNewBigFolderSizeLimitC[] = "useNewBigFolderSizeLimit";
 static const char confirmExternalStorageC[] = "confirmExternalStorage";
 static const char moveToTrashC[] = "moveToTrash";
+static const char bulkInitialDiscoveryC[] = "bulkInitialDiscovery";
 
 static const char maxLogLinesC[] = "Logging/maxLogLines";
 
@@ -761,6 +762,11 @@ void ConfigFile::setMoveToTrash(bool isChecked)
     setValue(moveToTrashC, isChecked);
 }
 
+bool ConfigFile::bulkInitialDiscovery() const
+{
+    return getValue(bulkInitialDiscoveryC, QString(), false).toBool();
+}
+
 bool ConfigFile::promptDeleteFiles() const
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -134,6 +134,9 @@ public:
     bool moveToTrash() const;
     void setMoveToTrash(bool);
 
+    /** If the first sync of a folder should list the remote tree with a single request */
+    bool bulkInitialDiscovery() const;
+
     static bool setConfDir(const QString &value);
 
     bool optionalServerNotifications() const;
@@ -256,6 +256,7 @@ DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &accou
     , _account(account)
     , _ignoredFirst(false)
     , _isRootPath(false)
+    , _isRecursive(false)
     , _isExternalStorage(false)
 {
 }
@@ -283,6 +284,9 @@ void DiscoverySingleDirectoryJob::start()
     }
 
     lsColJob->setProperties(props);
+    if (_isRecursive) {
+        lsColJob->setDepth("infinity");
+    }
 
     QObject::connect(lsColJob, &LsColJob::directoryListingIterated,
         this, &DiscoverySingleDirectoryJob::directoryListingIteratedSlot);
@@ -351,6 +355,7 @@ static void propertyMapToFileStat(const QMap<QString, QString> &map, csync_file_
 
 void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, const QMap<QString, QString> &map)
 {
+    bool isDirectChild = true;
     if (!_ignoredFirst) {
         // The first entry is for the folder itself, we should process it differently.
         _ignoredFirst = true;
@@ -377,6 +382,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
         while (file.startsWith('/')) {
             file = file.remove(0, 1);
         }
+        isDirectChild = !file.contains(QLatin1Char('/'));
 
         std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
         file_stat->path = file.toUtf8();
@@ -413,7 +419,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains("getetag")) {
+    if (map.contains("getetag") && isDirectChild) {
         _etagConcatenation += map.value("getetag");
 
         if (_firstEtag.isEmpty()) {
@@ -477,8 +483,7 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
         Qt::QueuedConnection);
 }
 
-// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+QString DiscoveryMainThread::fullRemotePath(const QString &subPath) const
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -489,33 +494,106 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     while (fullPath.endsWith('/')) {
         fullPath.chop(1);
     }
+    return fullPath;
+}
+
+void DiscoveryMainThread::connectSingleDirectoryJob(DiscoverySingleDirectoryJob *job)
+{
+    QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithResult,
+        this, &DiscoveryMainThread::singleDirectoryJobResultSlot);
+    QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithError,
+        this, &DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot);
+    QObject::connect(job, &DiscoverySingleDirectoryJob::firstDirectoryPermissions,
+        this, &DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot);
+    QObject::connect(job, &DiscoverySingleDirectoryJob::etagConcatenation,
+        this, &DiscoveryMainThread::etagConcatenation);
+    QObject::connect(job, &DiscoverySingleDirectoryJob::etag,
+        this, &DiscoveryMainThread::etag);
+}
+
+// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+{
+    QString fullPath = fullRemotePath(subPath);
 
     _discoveryJob->update_job_update_callback(/*local=*/false, subPath.toUtf8(), _discoveryJob);
 
     // Result gets written in there
     _currentDiscoveryDirectoryResult = r;
     _currentDiscoveryDirectoryResult->path = fullPath;
+    _currentSubPath = subPath;
+    _openedDirectories.insert(subPath);
+
+    // The sync thread walks the tree depth first: it is done with the opened
+    // directories that don't contain this one. The listings of their
+    // subdirectories that were not picked up are not going to be (excluded
+    // or ignored directories), drop them so they don't use up the budget of
+    // startPrefetchJobs().
+    while (!_openDirectoryStack.empty()) {
+        const QString &openPath = _openDirectoryStack.back();
+        if (openPath.isEmpty() || subPath == openPath || subPath.startsWith(openPath + QLatin1Char('/')))
+            break;
+        dropPrefetchedChildren(openPath);
+        _openDirectoryStack.pop_back();
+    }
+    _openDirectoryStack.push_back(subPath);
+
+    if (std::unique_ptr<PrefetchedDirectory> entry = takePrefetched(subPath)) {
+        if (entry->finished) {
+            qCDebug(lcDiscovery) << "Using prefetched listing for" << fullPath;
+            _currentDiscoveryDirectoryResult->list = std::move(entry->result.list);
+            _currentDiscoveryDirectoryResult->code = entry->result.code;
+            _currentDiscoveryDirectoryResult->msg = entry->result.msg;
+            deliverCurrentResult();
+            return;
+        }
 
+        if (entry->job) {
+            // The listing is still in progress: take it over as if it had just been started
+            qCDebug(lcDiscovery) << "Waiting for prefetched listing of" << fullPath;
+            QObject::disconnect(entry->job.data(), nullptr, this, nullptr);
+            _singleDirJob = entry->job;
+            connectSingleDirectoryJob(_singleDirJob.data());
+            return;
+        }
+    }
+
+    startSingleDirectoryJob(fullPath);
+}
+
+void DiscoveryMainThread::startSingleDirectoryJob(const QString &fullPath)
+{
     // Schedule the DiscoverySingleDirectoryJob
     _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult,
-        this, &DiscoveryMainThread::singleDirectoryJobResultSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithError,
-        this, &DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::firstDirectoryPermissions,
-        this, &DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::etagConcatenation,
-        this, &DiscoveryMainThread::etagConcatenation);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::etag,
-        this, &DiscoveryMainThread::etag);
+    connectSingleDirectoryJob(_singleDirJob.data());
 
     if (!_firstFolderProcessed) {
         _singleDirJob->setIsRootPath();
+        if (_bulkDiscovery) {
+            _singleDirJob->setRecursive();
+        }
     }
 
     _singleDirJob->start();
 }
 
+void DiscoveryMainThread::deliverCurrentResult()
+{
+    qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
+
+    // Look for subdirectories to list while the sync thread processes this one
+    if (_currentDiscoveryDirectoryResult->code == 0) {
+        queuePrefetch(_currentSubPath, _currentDiscoveryDirectoryResult->list);
+    }
+
+    _currentDiscoveryDirectoryResult = nullptr; // the sync thread owns it now
+
+    _discoveryJob->_vioMutex.lock();
+    _discoveryJob->_vioWaitCondition.wakeAll();
+    _discoveryJob->_vioMutex.unlock();
+
+    startPrefetchJobs();
+}
 
 void DiscoveryMainThread::singleDirectoryJobResultSlot()
 {
@@ -525,19 +603,16 @@ void DiscoveryMainThread::singleDirectoryJobResultSlot()
 
     _currentDiscoveryDirectoryResult->list = _singleDirJob->takeResults();
     _currentDiscoveryDirectoryResult->code = 0;
-
-    qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
-
-    _currentDiscoveryDirectoryResult = nullptr; // the sync thread owns it now
+    if (_singleDirJob->isRecursive()) {
+        _currentDiscoveryDirectoryResult->list = splitRecursiveListing(std::move(_currentDiscoveryDirectoryResult->list));
+    }
 
     if (!_firstFolderProcessed) {
         _firstFolderProcessed = true;
         _dataFingerprint = _singleDirJob->_dataFingerprint;
     }
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    deliverCurrentResult();
 }
 
 void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
@@ -547,13 +622,242 @@ void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrno
     }
     qCDebug(lcDiscovery) << csyncErrnoCode << msg;
 
+    if (_singleDirJob && _singleDirJob->isRecursive()) {
+        qCInfo(lcDiscovery) << "Listing the whole tree failed, listing each directory instead" << csyncErrnoCode << msg;
+        _bulkDiscovery = false;
+        startSingleDirectoryJob(_currentDiscoveryDirectoryResult->path);
+        return;
+    }
+
     _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
     _currentDiscoveryDirectoryResult->msg = msg;
-    _currentDiscoveryDirectoryResult = nullptr; // the sync thread owns it now
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    deliverCurrentResult();
+}
+
+/* Distribute the entries of a Depth: infinity listing of the root into one listing
+ * per directory, as if each directory had been listed separately. The listings of
+ * the subdirectories are stored as prefetched, the ones of the root are returned.
+ */
+std::deque<std::unique_ptr<csync_file_stat_t>> DiscoveryMainThread::splitRecursiveListing(std::deque<std::unique_ptr<csync_file_stat_t>> entries)
+{
+    std::deque<std::unique_ptr<csync_file_stat_t>> rootEntries;
+    QHash<QByteArray, csync_file_stat_t *> directories;
+    QHash<QByteArray, PrefetchedDirectory *> listings;
+    for (const auto &entry : entries) {
+        if (entry->type != ItemTypeDirectory) {
+            continue;
+        }
+        directories.insert(entry->path, entry.get());
+
+        // Every directory gets a listing, even if it is empty
+        std::unique_ptr<PrefetchedDirectory> listing(new PrefetchedDirectory);
+        listing->finished = true;
+        listing->result.code = 0;
+        listing->result.path = fullRemotePath(QString::fromUtf8(entry->path));
+        listings.insert(entry->path, listing.get());
+        insertPrefetched(QString::fromUtf8(entry->path), std::move(listing));
+    }
+
+    for (auto &entry : entries) {
+        int slashPos = entry->path.lastIndexOf('/');
+        if (slashPos < 0) {
+            rootEntries.push_back(std::move(entry));
+            continue;
+        }
+
+        QByteArray parentPath = entry->path.left(slashPos);
+        PrefetchedDirectory *listing = listings.value(parentPath);
+        if (!listing) {
+            qCWarning(lcDiscovery) << "Entry without parent directory in the listing:" << entry->path;
+            continue;
+        }
+
+        // Same as in DiscoverySingleDirectoryJob::directoryListingIteratedSlot: only the
+        // mount points of external storages keep the 'M' permission.
+        csync_file_stat_t *parent = directories.value(parentPath);
+        if (entry->remotePerm.hasPermission(RemotePermissions::IsMounted)
+            && (parent->remotePerm.hasPermission(RemotePermissions::IsMounted)
+                   || parent->remotePerm.hasPermission(RemotePermissions::IsMountedSub))) {
+            entry->remotePerm.unsetPermission(RemotePermissions::IsMounted);
+            entry->remotePerm.setPermission(RemotePermissions::IsMountedSub);
+        }
+
+        entry->path = entry->path.mid(slashPos + 1);
+        listing->result.list.push_back(std::move(entry));
+    }
+
+    qCInfo(lcDiscovery) << "Listed" << entries.size() << "entries in" << listings.size() + 1 << "directories with one request";
+    return rootEntries;
+}
+
+/* Find the subdirectories of \a subPath that the sync thread will need to list
+ * from the server, that is, the ones that will not be read from the database.
+ * This mirrors the checks done in _csync_detect_update.
+ */
+void DiscoveryMainThread::queuePrefetch(const QString &subPath, const std::deque<std::unique_ptr<csync_file_stat_t>> &entries)
+{
+    if (_maximumActiveJobs <= 1 || !_discoveryJob) {
+        return;
+    }
+
+    CSYNC *ctx = _discoveryJob->_csync_ctx;
+    std::vector<QString> candidates;
+    for (const auto &entry : entries) {
+        if (entry->type != ItemTypeDirectory) {
+            continue;
+        }
+        QString childPath = subPath.isEmpty()
+            ? QString::fromUtf8(entry->path)
+            : subPath + QLatin1Char('/') + QString::fromUtf8(entry->path);
+        if (_prefetchedDirectories.find(childPath) != _prefetchedDirectories.end()) {
+            continue; // Already listed or being listed
+        }
+
+        // The black list is not modified during discovery, so it is safe to read from this thread.
+        const auto &blackList = _discoveryJob->_selectiveSyncBlackList;
+        if (!blackList.isEmpty() && findPathInList(blackList, childPath)) {
+            continue;
+        }
+
+        if (ctx->read_remote_from_db) {
+            SyncJournalFileRecord record;
+            if (ctx->statedb->getFileRecord(childPath.toUtf8(), &record)
+                && record.isValid()
+                && record._etag == entry->etag
+                && record._fileId == entry->file_id
+                && record._remotePerm == entry->remotePerm) {
+                continue; // Will be read from the database
+            }
+        }
+        candidates.push_back(childPath);
+    }
+
+    // The sync thread walks the tree depth first, so the children come next
+    _prefetchQueue.insert(_prefetchQueue.begin(), candidates.begin(), candidates.end());
+}
+
+static QString parentDirectory(const QString &subPath)
+{
+    return subPath.left(qMax(0, subPath.lastIndexOf(QLatin1Char('/'))));
+}
+
+void DiscoveryMainThread::insertPrefetched(const QString &subPath, std::unique_ptr<PrefetchedDirectory> entry)
+{
+    dropPrefetched(subPath);
+    if (entry->finished) {
+        ++_prefetchesFinished;
+    } else {
+        ++_prefetchesRunning;
+    }
+    _prefetchedChildren[parentDirectory(subPath)].insert(subPath);
+    _prefetchedDirectories[subPath] = std::move(entry);
+}
+
+std::unique_ptr<DiscoveryMainThread::PrefetchedDirectory> DiscoveryMainThread::takePrefetched(const QString &subPath)
+{
+    auto it = _prefetchedDirectories.find(subPath);
+    if (it == _prefetchedDirectories.end()) {
+        return nullptr;
+    }
+    std::unique_ptr<PrefetchedDirectory> entry = std::move(it->second);
+    _prefetchedDirectories.erase(it);
+    if (entry->finished) {
+        --_prefetchesFinished;
+    } else {
+        --_prefetchesRunning;
+    }
+
+    auto siblings = _prefetchedChildren.find(parentDirectory(subPath));
+    if (siblings != _prefetchedChildren.end()) {
+        siblings->remove(subPath);
+        if (siblings->isEmpty()) {
+            _prefetchedChildren.erase(siblings);
+        }
+    }
+    return entry;
+}
+
+/* Drops a listing that the sync thread is not going to pick up, along with the
+ * ones of its subdirectories.
+ */
+void DiscoveryMainThread::dropPrefetched(const QString &subPath)
+{
+    std::unique_ptr<PrefetchedDirectory> entry = takePrefetched(subPath);
+    if (!entry) {
+        return;
+    }
+
+    qCDebug(lcDiscovery) << "Dropping unused prefetched listing of" << subPath;
+    if (auto job = entry->job) {
+        disconnect(job.data(), nullptr, this, nullptr);
+        job->abort();
+    }
+    dropPrefetchedChildren(subPath);
+}
+
+void DiscoveryMainThread::dropPrefetchedChildren(const QString &parentPath)
+{
+    const QSet<QString> children = _prefetchedChildren.take(parentPath);
+    for (const auto &child : children) {
+        dropPrefetched(child);
+    }
+}
+
+void DiscoveryMainThread::startPrefetchJobs()
+{
+    // One slot is kept for the listing the sync thread is waiting on.
+    // Also bound the number of results waiting to be picked up, a listing that
+    // ends up not being used (e.g. excluded directory) is only dropped once the
+    // sync thread is done with its parent, see doOpendirSlot().
+    const int maxRunning = _maximumActiveJobs - 1;
+    const int maxPending = 2 * _maximumActiveJobs;
+    while (!_prefetchQueue.empty() && _prefetchesRunning < maxRunning
+        && _prefetchesRunning + _prefetchesFinished < maxPending) {
+        QString subPath = _prefetchQueue.front();
+        _prefetchQueue.pop_front();
+        if (_openedDirectories.contains(subPath)
+            || _prefetchedDirectories.find(subPath) != _prefetchedDirectories.end()) {
+            continue;
+        }
+
+        std::unique_ptr<PrefetchedDirectory> entry(new PrefetchedDirectory);
+        entry->result.path = fullRemotePath(subPath);
+        auto job = new DiscoverySingleDirectoryJob(_account, entry->result.path, this);
+        entry->job = job;
+        QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithResult, this, [this, subPath] {
+            prefetchJobFinished(subPath, 0, QString());
+        });
+        QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithError, this, [this, subPath](int csyncErrnoCode, const QString &msg) {
+            prefetchJobFinished(subPath, csyncErrnoCode, msg);
+        });
+        insertPrefetched(subPath, std::move(entry));
+
+        qCDebug(lcDiscovery) << "Prefetching" << subPath;
+        job->start();
+    }
+}
+
+void DiscoveryMainThread::prefetchJobFinished(const QString &subPath, int csyncErrnoCode, const QString &msg)
+{
+    auto it = _prefetchedDirectories.find(subPath);
+    if (it == _prefetchedDirectories.end()) {
+        return; // possibly aborted
+    }
+
+    PrefetchedDirectory &entry = *it->second;
+    entry.finished = true;
+    --_prefetchesRunning;
+    ++_prefetchesFinished;
+    entry.result.code = csyncErrnoCode;
+    entry.result.msg = msg;
+    if (csyncErrnoCode == 0 && entry.job) {
+        entry.result.list = entry.job->takeResults();
+        queuePrefetch(subPath, entry.result.list);
+    }
+    entry.job.clear();
+
+    startPrefetchJobs();
 }
 
 void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(RemotePermissions p)
@@ -567,15 +871,7 @@ void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(Remote
 
 void DiscoveryMainThread::doGetSizeSlot(const QString &path, qint64 *result)
 {
-    QString fullPath = _pathPrefix;
-    if (!_pathPrefix.endsWith('/')) {
-        fullPath += '/';
-    }
-    fullPath += path;
-    // remove trailing slash
-    while (fullPath.endsWith('/')) {
-        fullPath.chop(1);
-    }
+    QString fullPath = fullRemotePath(path);
 
     _currentGetSizeResult = result;
 
@@ -626,6 +922,18 @@ void DiscoveryMainThread::abort()
         disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult, this, nullptr);
         _singleDirJob->abort();
     }
+    for (const auto &it : _prefetchedDirectories) {
+        if (auto job = it.second->job) {
+            disconnect(job.data(), nullptr, this, nullptr);
+            job->abort();
+        }
+    }
+    _prefetchedDirectories.clear();
+    _prefetchedChildren.clear();
+    _prefetchesRunning = 0;
+    _prefetchesFinished = 0;
+    _openDirectoryStack.clear();
+    _prefetchQueue.clear();
     if (_currentDiscoveryDirectoryResult) {
         if (_discoveryJob->_vioMutex.tryLock()) {
             _currentDiscoveryDirectoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
@@ -716,9 +1024,23 @@ void DiscoveryJob::start()
     _csync_ctx->callbacks.remote_closedir_hook = remote_vio_closedir_hook;
     _csync_ctx->callbacks.vio_userdata = this;
 
+    // The journal lookups of the update phase all happen on this thread;
+    // give them a connection of their own so they don't wait on the main thread.
+    const bool hasReadConnection = _csync_ctx->statedb->openReadConnectionForCurrentThread();
+
+    // When the whole local tree is walked, most paths have a record; reading them
+    // all at once is much cheaper than a query per path. The snapshot is only kept
+    // for the update phase.
+    if (_loadMetadataSnapshot)
+        _csync_ctx->statedb->loadMetadataSnapshot();
+
     _lastUpdateProgressCallbackCall.invalidate();
     int ret = csync_update(_csync_ctx);
 
+    _csync_ctx->statedb->dropMetadataSnapshot();
+    if (hasReadConnection)
+        _csync_ctx->statedb->releaseReadConnection();
+
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = nullptr;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = nullptr;
     _csync_ctx->callbacks.update_callback = nullptr;
@@ -23,7 +23,12 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
+#include <QHash>
+#include <QSet>
 #include <deque>
+#include <map>
+#include <vector>
+#include <memory>
 #include "syncoptions.h"
 
 namespace OCC {
@@ -62,6 +67,10 @@ public:
     explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = nullptr);
     // Specify thgat this is the root and we need to check the data-fingerprint
     void setIsRootPath() { _isRootPath = true; }
+    // List the whole subtree with a single Depth: infinity request.
+    // The paths of the results are then relative to this directory.
+    void setRecursive() { _isRecursive = true; }
+    bool isRecursive() const { return _isRecursive; }
     void start();
     void abort();
     std::deque<std::unique_ptr<csync_file_stat_t>> &&takeResults() { return std::move(_results); }
@@ -89,6 +98,8 @@ private:
     bool _ignoredFirst;
     // Set to true if this is the root path and we need to check the data-fingerprint
     bool _isRootPath;
+    // Set to true if the whole subtree is listed
+    bool _isRecursive;
     // If this directory is an external storage (The first item has 'M' in its permission)
     bool _isExternalStorage;
     // If set, the discovery will finish with an error
@@ -105,14 +116,58 @@ class DiscoveryMainThread : public QObject
 {
     Q_OBJECT
 
+    /**
+     * A directory listing that was started before the sync thread asked for it.
+     *
+     * Once the job is done, the result is kept here until the sync thread opens
+     * the directory.
+     */
+    struct PrefetchedDirectory
+    {
+        QPointer<DiscoverySingleDirectoryJob> job;
+        bool finished = false;
+        DiscoveryDirectoryResult result;
+    };
+
     QPointer<DiscoveryJob> _discoveryJob;
     QPointer<DiscoverySingleDirectoryJob> _singleDirJob;
     QString _pathPrefix; // remote path
     AccountPtr _account;
     DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
+    QString _currentSubPath; // path of _currentDiscoveryDirectoryResult, relative to _pathPrefix
     qint64 *_currentGetSizeResult;
     bool _firstFolderProcessed;
 
+    // Maximum number of directory listings in flight. 1 means no prefetching.
+    int _maximumActiveJobs;
+    // Directories that likely need to be listed, in the order the sync thread is expected to open them
+    std::deque<QString> _prefetchQueue;
+    std::map<QString, std::unique_ptr<PrefetchedDirectory>> _prefetchedDirectories;
+    // The paths in _prefetchedDirectories, by parent path
+    QHash<QString, QSet<QString>> _prefetchedChildren;
+    // The entries of _prefetchedDirectories whose job is running or finished
+    int _prefetchesRunning = 0;
+    int _prefetchesFinished = 0;
+    // Directories the sync thread has already opened
+    QSet<QString> _openedDirectories;
+    // The opened directories the sync thread may still be walking, outermost first
+    std::vector<QString> _openDirectoryStack;
+    // If the root should be listed with a Depth: infinity request
+    bool _bulkDiscovery;
+
+    QString fullRemotePath(const QString &subPath) const;
+    void startSingleDirectoryJob(const QString &fullPath);
+    void connectSingleDirectoryJob(DiscoverySingleDirectoryJob *job);
+    std::deque<std::unique_ptr<csync_file_stat_t>> splitRecursiveListing(std::deque<std::unique_ptr<csync_file_stat_t>> entries);
+    void deliverCurrentResult();
+    void queuePrefetch(const QString &subPath, const std::deque<std::unique_ptr<csync_file_stat_t>> &entries);
+    void insertPrefetched(const QString &subPath, std::unique_ptr<PrefetchedDirectory> entry);
+    std::unique_ptr<PrefetchedDirectory> takePrefetched(const QString &subPath);
+    void dropPrefetched(const QString &subPath);
+    void dropPrefetchedChildren(const QString &parentPath);
+    void startPrefetchJobs();
+    void prefetchJobFinished(const QString &subPath, int csyncErrnoCode, const QString &msg);
+
 public:
     DiscoveryMainThread(AccountPtr account)
         : QObject()
@@ -120,10 +175,26 @@ public:
         , _currentDiscoveryDirectoryResult(nullptr)
         , _currentGetSizeResult(nullptr)
         , _firstFolderProcessed(false)
+        , _maximumActiveJobs(1)
+        , _bulkDiscovery(false)
     {
     }
     void abort();
 
+    /** Allow up to \a count directory listings to run in parallel.
+     *
+     * While the sync thread processes a directory, the subdirectories whose etag
+     * changed compared to the journal are listed ahead of time.
+     */
+    void setMaximumActiveJobs(int count) { _maximumActiveJobs = count; }
+
+    /** List the whole remote tree with a single request when the root is opened.
+     *
+     * Meant for the first sync, when every directory needs to be listed anyway.
+     * If the server refuses, the directories are listed one by one.
+     */
+    void setBulkDiscovery(bool enabled) { _bulkDiscovery = enabled; }
+
     QByteArray _dataFingerprint;
 
 
@@ -195,6 +266,9 @@ public:
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
     SyncOptions _syncOptions;
+    // Whether to read the whole metadata table up front, only worth it if
+    // the walk looks up (nearly) every path
+    bool _loadMetadataSnapshot = false;
     Q_INVOKABLE void start();
 signals:
     void finished(int result);
@@ -26,6 +26,12 @@ extern "C" int c_utimes(const char *, const struct timeval *);
 #include "std/c_string.h"
 #include "std/c_utf8.h"
 
+#if defined(Q_OS_LINUX) || defined(Q_OS_MAC)
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
 namespace OCC {
 
 bool FileSystem::fileEquals(const QString &fn1, const QString &fn2)
@@ -138,5 +144,35 @@ qint64 FileSystem::getSize(const QString &filename)
     return QFileInfo(filename).size();
 }
 
+bool FileSystem::preallocate(QFile &file, qint64 size)
+{
+    const int fd = file.handle();
+    if (fd < 0 || size <= 0)
+        return false;
+
+#if defined(Q_OS_LINUX)
+    // Also fills holes of a sparse file that already has its final size
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)
+        return true;
+    qCDebug(lcFileSystem) << "Could not preallocate" << file.fileName() << strerror(errno);
+    return false;
+#elif defined(Q_OS_MAC)
+    // Allocates from the end of the file; try a contiguous area first
+    if (size <= file.size())
+        return false;
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, size - file.size(), 0 };
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+            qCDebug(lcFileSystem) << "Could not preallocate" << file.fileName() << strerror(errno);
+            return false;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 
 } // namespace OCC
@@ -77,6 +77,18 @@ namespace FileSystem {
     bool verifyFileUnchanged(const QString &fileName,
         qint64 previousSize,
         time_t previousMtime);
+
+    /**
+ * @brief Reserve disk space for \a file to grow to \a size bytes
+ *
+ * The size of the file doesn't change. Reserving the space up front avoids
+ * fragmenting big files that are written piece by piece.
+ *
+ * The file must be open.
+ *
+ * @return false if the platform or file system doesn't support it.
+ */
+    bool OWNCLOUDSYNC_EXPORT preallocate(QFile &file, qint64 size);
 }
 
 /** @} */
@@ -156,138 +156,213 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader)
-{
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
-        }
 
-    } while (!reader.atEnd());
-    return result;
+LsColXMLParser::LsColXMLParser()
+{
 }
 
+bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
+{
+    start(fileInfo, expectedPath);
+    if (!addData(xml)) {
+        return false;
+    }
+    return finish();
+}
 
-LsColXMLParser::LsColXMLParser()
+void LsColXMLParser::start(QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
 {
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
+    _fileInfo = fileInfo;
+    _expectedPath = expectedPath;
+    _failed = false;
+
+    _capture = Capture::None;
+    _capturedText.clear();
+    _propertyName.clear();
+    _propertyLevel = 0;
+
+    _folders.clear();
+    _currentHref.clear();
+    _currentTmpProperties.clear();
+    _currentHttp200Properties.clear();
+    _currentPropsHaveHttp200 = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
 }
 
-bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
+bool LsColXMLParser::addData(const QByteArray &data)
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
-        // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
-            if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(reader.readElementText().toUtf8()));
-                if (!hrefString.startsWith(expectedPath)) {
-                    qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
-                }
-                currentHref = hrefString;
-            } else if (name == QLatin1String("response")) {
-            } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
+    if (_failed) {
+        return false;
+    }
+    _reader.addData(data);
+    if (!parseAvailableData()) {
+        _failed = true;
+    }
+    return !_failed;
+}
+
+bool LsColXMLParser::finish()
+{
+    if (_failed) {
+        return false;
+    }
+
+    if (_reader.hasError()) {
+        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString();
+        return false;
+    } else if (!_insideMultiStatus) {
+        qCWarning(lcLsColJob) << "ERROR no WebDAV response?";
+        return false;
+    } else {
+        emit directoryListingSubfolders(_folders);
+        emit finishedWithoutError();
+    }
+    return true;
+}
+
+/* Consume the tokens that are complete in the data received so far.
+ * Since the rest of an element may only arrive with the next chunk, the text of
+ * the elements we are interested in is accumulated in _capturedText instead of
+ * using QXmlStreamReader::readElementText().
+ */
+bool LsColXMLParser::parseAvailableData()
+{
+    if (_reader.tokenType() == QXmlStreamReader::EndDocument) {
+        return true;
+    }
+
+    while (true) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+        if (type == QXmlStreamReader::Invalid || type == QXmlStreamReader::EndDocument) {
+            break;
+        }
+
+        if (_capture == Capture::Property) {
+            // supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
+            if (type == QXmlStreamReader::StartElement) {
+                _propertyLevel++;
+                _capturedText += "<" + _reader.name().toString() + ">";
+            } else if (type == QXmlStreamReader::Characters) {
+                _capturedText += _reader.text();
+            } else if (type == QXmlStreamReader::EndElement) {
+                if (_propertyLevel == 0) {
+                    endProperty();
                 } else {
-                    currentPropsHaveHttp200 = false;
+                    _propertyLevel--;
+                    _capturedText += "</" + _reader.name().toString() + ">";
                 }
-            } else if (name == QLatin1String("prop")) {
-                insideProp = true;
-                continue;
-            } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
-                continue;
             }
+            continue;
         }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
+        if (_capture != Capture::None) {
+            if (type == QXmlStreamReader::Characters) {
+                _capturedText += _reader.text();
+            } else if (type == QXmlStreamReader::EndElement && !endElement()) {
+                return false;
+            }
+            continue;
+        }
+
+        if (type == QXmlStreamReader::StartElement && _insideProp) {
             // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("size")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && fileInfo) {
-                    (*fileInfo)[currentHref].size = s;
-                }
-            } else if (name == QLatin1String("fileid")) {
-                (*fileInfo)[currentHref].fileId = propertyContent.toUtf8();
+            _capture = Capture::Property;
+            _capturedText.clear();
+            _propertyName = _reader.name().toString();
+            _propertyLevel = 0;
+            continue;
+        }
+
+        // Start elements with DAV:
+        if (type == QXmlStreamReader::StartElement && _reader.namespaceUri() == QLatin1String("DAV:")) {
+            QStringRef name = _reader.name();
+            if (name == QLatin1String("href")) {
+                _capture = Capture::Href;
+                _capturedText.clear();
+            } else if (name == QLatin1String("propstat")) {
+                _insidePropstat = true;
+            } else if (name == QLatin1String("status") && _insidePropstat) {
+                _capture = Capture::Status;
+                _capturedText.clear();
+            } else if (name == QLatin1String("prop")) {
+                _insideProp = true;
+            } else if (name == QLatin1String("multistatus")) {
+                _insideMultiStatus = true;
             }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
         }
 
         // End elements with DAV:
-        if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
-                    }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString, QString>(currentTmpProperties);
-                    }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
+        if (type == QXmlStreamReader::EndElement && _reader.namespaceUri() == QLatin1String("DAV:")) {
+            if (_reader.name() == "response") {
+                if (_currentHref.endsWith('/')) {
+                    _currentHref.chop(1);
+                }
+                emit directoryListingIterated(_currentHref, _currentHttp200Properties);
+                _currentHref.clear();
+                _currentHttp200Properties.clear();
+            } else if (_reader.name() == "propstat") {
+                _insidePropstat = false;
+                if (_currentPropsHaveHttp200) {
+                    _currentHttp200Properties = QMap<QString, QString>(_currentTmpProperties);
                 }
+                _currentTmpProperties.clear();
+                _currentPropsHaveHttp200 = false;
+            } else if (_reader.name() == "prop") {
+                _insideProp = false;
             }
         }
     }
 
-    if (reader.hasError()) {
-        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qCWarning(lcLsColJob) << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qCWarning(lcLsColJob) << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
+    return !_reader.hasError() || _reader.error() == QXmlStreamReader::PrematureEndOfDocumentError;
+}
+
+// End of a <d:href> or <d:status> element
+bool LsColXMLParser::endElement()
+{
+    if (_capture == Capture::Href) {
+        // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+        // but the result will have URL encoding..
+        QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(_capturedText.toUtf8()));
+        if (!hrefString.startsWith(_expectedPath)) {
+            qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+            return false;
+        }
+        _currentHref = hrefString;
+    } else if (_capture == Capture::Status) {
+        _currentPropsHaveHttp200 = _capturedText.startsWith("HTTP/1.1 200");
     }
+    _capture = Capture::None;
+    _capturedText.clear();
     return true;
 }
 
+void LsColXMLParser::endProperty()
+{
+    const QString &propertyContent = _capturedText;
+    if (_propertyName == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
+        _folders.append(_currentHref);
+    } else if (_propertyName == QLatin1String("size")) {
+        bool ok = false;
+        auto s = propertyContent.toLongLong(&ok);
+        if (ok && _fileInfo) {
+            (*_fileInfo)[_currentHref].size = s;
+        }
+    } else if (_propertyName == QLatin1String("fileid")) {
+        if (_fileInfo) {
+            (*_fileInfo)[_currentHref].fileId = propertyContent.toUtf8();
+        }
+    }
+    _currentTmpProperties.insert(_propertyName, propertyContent);
+
+    _capture = Capture::None;
+    _capturedText.clear();
+}
+
 /*********************************************************************************************/
 
 LsColJob::LsColJob(AccountPtr account, const QString &path, QObject *parent)
@@ -334,7 +409,7 @@ void LsColJob::start()
     }
 
     QNetworkRequest req;
-    req.setRawHeader("Depth", "1");
+    req.setRawHeader("Depth", _depth);
     QByteArray xml("<?xml version=\"1.0\" ?>\n"
                    "<d:propfind xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
                    "  <d:prop>\n"
@@ -351,37 +426,60 @@ void LsColJob::start()
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+void LsColJob::newReplyHook(QNetworkReply *reply)
 {
-    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
-                       << replyStatusString();
+    connect(reply, &QIODevice::readyRead, this, &LsColJob::slotReadyRead);
+}
 
+bool LsColJob::isMultiStatusReply() const
+{
     QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
     int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect(&parser, &LsColXMLParser::directoryListingSubfolders,
+    return httpCode == 207 && contentType.contains("application/xml; charset=utf-8");
+}
+
+// Parse the reply while it is coming from the network instead of all in one big blob at the end.
+void LsColJob::slotReadyRead()
+{
+    if (_parserFailed || !reply() || !isMultiStatusReply()) {
+        return;
+    }
+
+    if (!_parserStarted) {
+        connect(&_parser, &LsColXMLParser::directoryListingSubfolders,
             this, &LsColJob::directoryListingSubfolders);
-        connect(&parser, &LsColXMLParser::directoryListingIterated,
+        connect(&_parser, &LsColXMLParser::directoryListingIterated,
             this, &LsColJob::directoryListingIterated);
-        connect(&parser, &LsColXMLParser::finishedWithError,
+        connect(&_parser, &LsColXMLParser::finishedWithError,
             this, &LsColJob::finishedWithError);
-        connect(&parser, &LsColXMLParser::finishedWithoutError,
+        connect(&_parser, &LsColXMLParser::finishedWithoutError,
             this, &LsColJob::finishedWithoutError);
 
         QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if (!parser.parse(reply()->readAll(), &_folderInfos, expectedPath)) {
+        _parser.start(&_folderInfos, expectedPath);
+        _parserStarted = true;
+    }
+
+    if (!_parser.addData(reply()->readAll())) {
+        // XML parse error, reported once the reply is finished
+        _parserFailed = true;
+    }
+}
+
+bool LsColJob::finished()
+{
+    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
+                       << replyStatusString();
+
+    if (isMultiStatusReply()) {
+        // Consume what is left in the buffer
+        slotReadyRead();
+        if (_parserFailed || !_parser.finish()) {
             // XML parse error
             emit finishedWithError(reply());
         }
-    } else if (httpCode == 207) {
-        // wrong content type
-        emit finishedWithError(reply());
     } else {
-        // wrong HTTP code or any other network error
+        // wrong content type, wrong HTTP code or any other network error
         emit finishedWithError(reply());
     }
 
@@ -390,6 +488,86 @@ bool LsColJob::finished()
 
 /*********************************************************************************************/
 
+// The last segment of a remote path or href, for comparing the two
+static QString etagBatchName(QString path)
+{
+    if (path.endsWith(QLatin1Char('/')))
+        path.chop(1);
+    return path.mid(path.lastIndexOf(QLatin1Char('/')) + 1).normalized(QString::NormalizationForm_C);
+}
+
+EtagBatchJob::EtagBatchJob(AccountPtr account, const QString &path, const QStringList &folderPaths, QObject *parent)
+    : QObject(parent)
+    , _account(account)
+    , _path(path)
+{
+    auto withoutTrailingSlash = [](QString path) {
+        if (path.endsWith(QLatin1Char('/')))
+            path.chop(1);
+        return path;
+    };
+    foreach (const QString &folderPath, folderPaths) {
+        if (withoutTrailingSlash(folderPath) == withoutTrailingSlash(path)) {
+            _selfFolder = folderPath;
+        } else {
+            _pendingFolders.insert(etagBatchName(folderPath), folderPath);
+        }
+    }
+}
+
+void EtagBatchJob::start()
+{
+    auto job = new LsColJob(_account, _path, this);
+    job->setProperties(QList<QByteArray>() << "getetag");
+    job->setTimeout(60 * 1000);
+    connect(job, &LsColJob::directoryListingIterated, this, &EtagBatchJob::slotListingIterated);
+    connect(job, &LsColJob::finishedWithoutError, this, &EtagBatchJob::reportNotListed);
+    connect(job, &LsColJob::finishedWithError, this, [this](QNetworkReply *reply) {
+        qCInfo(lcLsColJob) << "ETag check of" << _path << "failed:" << reply->errorString();
+        reportNotListed();
+    });
+    job->start();
+}
+
+void EtagBatchJob::slotListingIterated(const QString &href, const QMap<QString, QString> &properties)
+{
+    auto etag = properties.find(QStringLiteral("getetag"));
+
+    // The first entry is the listed directory itself, which may have the
+    // same name as one of the folders
+    if (!_listedSelf) {
+        _listedSelf = true;
+        if (!_selfFolder.isNull() && etag != properties.end()) {
+            emit etagRetrieved(_selfFolder, *etag);
+            _selfFolder.clear();
+        }
+        return;
+    }
+    if (etag == properties.end())
+        return;
+    const QString folderPath = _pendingFolders.take(etagBatchName(href));
+    if (!folderPath.isNull())
+        emit etagRetrieved(folderPath, *etag);
+}
+
+void EtagBatchJob::reportNotListed()
+{
+    // Moved, deleted or not readable: whoever started the job should
+    // look at these folders on their own
+    auto folderPaths = _pendingFolders.values();
+    _pendingFolders.clear();
+    if (!_selfFolder.isNull()) {
+        folderPaths.append(_selfFolder);
+        _selfFolder.clear();
+    }
+    foreach (const QString &folderPath, folderPaths) {
+        emit folderNotListed(folderPath);
+    }
+    deleteLater();
+}
+
+/*********************************************************************************************/
+
 namespace {
     const char statusphpC[] = "status.php";
     const char nextcloudDirC[] = "nextcloud/";
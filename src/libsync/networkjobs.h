@@ -20,6 +20,7 @@
 
 #include <QBuffer>
 #include <QUrlQuery>
+#include <QXmlStreamReader>
 #include <functional>
 
 class QUrl;
@@ -81,15 +82,59 @@ class OWNCLOUDSYNC_EXPORT LsColXMLParser : public QObject
 public:
     explicit LsColXMLParser();
 
+    /** Parse a complete PROPFIND reply. */
     bool parse(const QByteArray &xml,
                QHash<QString, ExtraFolderInfo> *sizes,
                const QString &expectedPath);
 
+    /**
+     * Incremental parsing: call start() once, then addData() with each chunk
+     * of the reply as it arrives, and finish() when the reply is complete.
+     *
+     * directoryListingIterated is emitted as soon as a response element was read.
+     * addData() and finish() return false if the reply is invalid.
+     */
+    void start(QHash<QString, ExtraFolderInfo> *sizes, const QString &expectedPath);
+    bool addData(const QByteArray &data);
+    bool finish();
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
+
+private:
+    bool parseAvailableData();
+    bool endElement();
+    void endProperty();
+
+    enum class Capture {
+        None,
+        Href,
+        Status,
+        Property
+    };
+
+    QXmlStreamReader _reader;
+    QHash<QString, ExtraFolderInfo> *_fileInfo = nullptr;
+    QString _expectedPath;
+    bool _failed = false;
+
+    // Text of the element currently being read, see _capture
+    Capture _capture = Capture::None;
+    QString _capturedText;
+    QString _propertyName;
+    int _propertyLevel = 0;
+
+    QStringList _folders;
+    QString _currentHref;
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    bool _currentPropsHaveHttp200 = false;
+    bool _insidePropstat = false;
+    bool _insideProp = false;
+    bool _insideMultiStatus = false;
 };
 
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob
@@ -112,6 +157,13 @@ public:
     void setProperties(QList<QByteArray> properties);
     QList<QByteArray> properties() const;
 
+    /**
+     * The Depth header of the PROPFIND, "1" by default.
+     *
+     * With "infinity", the whole subtree is listed. Servers may refuse such requests.
+     */
+    void setDepth(const QByteArray &depth) { _depth = depth; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
@@ -120,10 +172,55 @@ signals:
 
 private slots:
     bool finished() override;
+    void slotReadyRead();
+
+protected:
+    void newReplyHook(QNetworkReply *reply) override;
 
 private:
+    bool isMultiStatusReply() const;
+
     QList<QByteArray> _properties;
     QUrl _url; // Used instead of path() if the url is specified in the constructor
+    QByteArray _depth = "1";
+
+    // The reply is parsed as it arrives
+    LsColXMLParser _parser;
+    bool _parserStarted = false;
+    bool _parserFailed = false;
+};
+
+/**
+ * @brief Checks the etags of several folders with one listing of their parent
+ *
+ * Every folder is reported exactly once: either with etagRetrieved() or,
+ * if the listing failed or didn't contain it, with folderNotListed().
+ * The job deletes itself afterwards.
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT EtagBatchJob : public QObject
+{
+    Q_OBJECT
+public:
+    /// folderPaths are the remote paths of direct children of path, or of path itself
+    explicit EtagBatchJob(AccountPtr account, const QString &path, const QStringList &folderPaths, QObject *parent = nullptr);
+    void start();
+
+signals:
+    void etagRetrieved(const QString &folderPath, const QString &etag);
+    void folderNotListed(const QString &folderPath);
+
+private:
+    void slotListingIterated(const QString &href, const QMap<QString, QString> &properties);
+    void reportNotListed();
+
+    AccountPtr _account;
+    QString _path;
+    /// The folders that weren't reported yet, by name
+    QHash<QString, QString> _pendingFolders;
+    /// The folder at path itself, if any and not reported yet
+    QString _selfFolder;
+    bool _listedSelf = false;
 };
 
 /**
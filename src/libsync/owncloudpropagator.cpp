@@ -73,31 +73,91 @@ qint64 freeSpaceLimit()
     return value;
 }
 
+QList<OwncloudPropagator *> OwncloudPropagator::s_propagators;
+
 OwncloudPropagator::~OwncloudPropagator()
 {
+    s_propagators.removeAll(this);
+    // The jobs of this sync no longer count against the shared budget
+    wakeJobBudgetWaiters();
+}
+
+void OwncloudPropagator::wakeJobBudgetWaiters(const OwncloudPropagator *except)
+{
+    int sharedActiveJobs = 0;
+    for (auto propagator : s_propagators)
+        sharedActiveJobs += propagator->_activeJobList.count();
+    for (auto propagator : s_propagators) {
+        if (propagator != except && propagator->_waitingForJobBudget
+            && sharedActiveJobs < propagator->hardMaximumActiveJob()) {
+            propagator->_waitingForJobBudget = false;
+            propagator->scheduleNextJob();
+        }
+    }
 }
 
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0
-        || _uploadLimit.fetchAndAddAcquire(0) != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
+    // The BandwidthManager splits a network limit fairly between the
+    // transfers, so limits don't require serializing them.
+    if (!_syncOptions._parallelNetworkJobs)
         return 1;
+    return _concurrency.limit(ConcurrencyController::Transfer);
+}
+
+void OwncloudPropagator::reportJobFinished(const SyncFileItem &item, bool likelyFinishedQuickly, qint64 durationMsecs)
+{
+    const quint64 creditedBytes = _creditedTransferBytes.take(&item);
+
+    // Only jobs that talked to the server tell something about its capacity
+    bool usesNetwork = false;
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+    case CSYNC_INSTRUCTION_TYPE_CHANGE:
+        usesNetwork = item._direction == SyncFileItem::Up || !item.isDirectory();
+        break;
+    case CSYNC_INSTRUCTION_REMOVE:
+    case CSYNC_INSTRUCTION_RENAME:
+        usesNetwork = item._direction == SyncFileItem::Up;
+        break;
+    default:
+        break;
+    }
+    if (!usesNetwork || durationMsecs < 0)
+        return;
+
+    const int code = item._httpErrorCode;
+    const bool overloaded = code == 408 || code == 429 || code == 502 || code == 503 || code == 504;
+    if (item.hasErrorStatus() && !overloaded) {
+        // Other errors say nothing about the capacity
+        return;
     }
-    return qMin(3, qCeil(hardMaximumActiveJob() / 2.));
+
+    const auto jobClass = likelyFinishedQuickly ? ConcurrencyController::Quick : ConcurrencyController::Transfer;
+    // Most of a transfer's bytes were already credited while it was running
+    const qint64 bytes = item.hasErrorStatus() || item.isDirectory() || creditedBytes >= item._size
+        ? 0
+        : item._size - creditedBytes;
+    _concurrency.jobFinished(jobClass, bytes, durationMsecs, overloaded);
 }
 
 /* The maximum number of active jobs in parallel  */
 int OwncloudPropagator::hardMaximumActiveJob()
 {
-    if (!_syncOptions._parallelNetworkJobs)
+    return hardMaximumActiveJob(_account, _syncOptions);
+}
+
+int OwncloudPropagator::hardMaximumActiveJob(const AccountPtr &account, const SyncOptions &syncOptions)
+{
+    if (!syncOptions._parallelNetworkJobs)
         return 1;
     static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
     if (max)
         return max;
-    if (_account->isHttp2Supported())
+    if (account->isHttp2Supported())
         return 20;
     return 6; // (Qt cannot do more anyway)
 }
@@ -274,6 +334,11 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
         break;
     }
 
+    propagator()->reportJobFinished(*_item, isLikelyFinishedQuickly(), _runTimer.isValid() ? _runTimer.elapsed() : -1);
+    // The parent may finalize instead of scheduling more jobs, other syncs
+    // waiting for the shared budget must not depend on that
+    OwncloudPropagator::wakeJobBudgetWaiters();
+
     if (_item->hasErrorStatus())
         qCWarning(lcPropagator) << "Could not complete propagation of" << _item->destination() << "by" << this << "with status" << _item->_status << "and error:" << _item->_errorString;
     else
@@ -524,6 +589,25 @@ void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
 {
     _syncOptions = syncOptions;
     _chunkSize = syncOptions._initialChunkSize;
+
+    // Continue where the last sync of the account stopped. The first sync
+    // starts where the fixed limits used to be. The controller adjusts from there.
+    const int hardMaximum = hardMaximumActiveJob();
+    int initialTransfer = _account->learnedConcurrency(ConcurrencyController::Transfer);
+    if (initialTransfer <= 0)
+        initialTransfer = qMin(3, qCeil(hardMaximum / 2.));
+    int initialQuick = _account->learnedConcurrency(ConcurrencyController::Quick);
+    if (initialQuick <= 0)
+        initialQuick = hardMaximum;
+    _concurrency.setLimits(ConcurrencyController::Transfer, 1, initialTransfer, hardMaximum);
+    _concurrency.setLimits(ConcurrencyController::Quick, 1, initialQuick, hardMaximum);
+}
+
+void OwncloudPropagator::saveLearnedConcurrency()
+{
+    qCInfo(lcPropagator) << "Parallelism at the end of the sync:" << _concurrency.status();
+    _account->setLearnedConcurrency(ConcurrencyController::Transfer, _concurrency.limit(ConcurrencyController::Transfer));
+    _account->setLearnedConcurrency(ConcurrencyController::Quick, _concurrency.limit(ConcurrencyController::Quick));
 }
 
 bool OwncloudPropagator::localFileNameClash(const QString &relFile)
@@ -619,24 +703,34 @@ void OwncloudPropagator::scheduleNextJobImpl()
 {
     // TODO: If we see that the automatic up-scaling has a bad impact we
     // need to check how to avoid this.
-    // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
+    // Concurrent syncs together don't run more jobs than a single one may.
+    // Wake up the ones that were waiting if there is room again.
+    wakeJobBudgetWaiters(this);
+    int sharedActiveJobs = 0;
+    for (auto propagator : s_propagators)
+        sharedActiveJobs += propagator->_activeJobList.count();
+    if (sharedActiveJobs >= hardMaximumActiveJob() && sharedActiveJobs > _activeJobList.count()) {
+        _waitingForJobBudget = true;
+        return;
+    }
+
     if (_activeJobList.count() < maximumActiveTransferJob()) {
         if (_rootJob->scheduleSelfOrChild()) {
             scheduleNextJob();
         }
     } else if (_activeJobList.count() < hardMaximumActiveJob()) {
+        // Jobs that are likely to finish quickly don't count against the
+        // transfer limit: for each of them, we can launch another one, up to
+        // the limit for such jobs.
         int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
-        // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
-        // be counted too.
-        for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
+        for (auto job : _activeJobList) {
+            if (job->isLikelyFinishedQuickly()) {
                 likelyFinishedQuicklyCount++;
             }
         }
+        likelyFinishedQuicklyCount = qMin(likelyFinishedQuicklyCount, _concurrency.limit(ConcurrencyController::Quick));
         if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
             qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << _activeJobList.count();
             if (_rootJob->scheduleSelfOrChild()) {
@@ -648,6 +742,14 @@ void OwncloudPropagator::scheduleNextJobImpl()
 
 void OwncloudPropagator::reportProgress(const SyncFileItem &item, quint64 bytes)
 {
+    // Small files are quick jobs, their throughput is measured in jobs
+    if (item._size >= smallFileSize()) {
+        quint64 &credited = _creditedTransferBytes[&item];
+        if (bytes > credited) {
+            _concurrency.bytesTransferred(ConcurrencyController::Transfer, bytes - credited);
+            credited = bytes;
+        }
+    }
     emit progress(item, bytes);
 }
 
@@ -29,6 +29,7 @@
 #include "syncfileitem.h"
 #include "common/syncjournaldb.h"
 #include "bandwidthmanager.h"
+#include "concurrencycontroller.h"
 #include "accountfwd.h"
 #include "syncoptions.h"
 
@@ -195,12 +196,17 @@ public:
         qCInfo(lcPropagator) << "Starting" << instruction_str << "propagation of" << _item->_file << "by" << this;
 
         _state = Running;
+        _runTimer.start();
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
 
     SyncFileItemPtr _item;
 
+private:
+    // Time since the job was started, fed to the ConcurrencyController
+    QElapsedTimer _runTimer;
+
 public slots:
     virtual void start() = 0;
 };
@@ -380,6 +386,7 @@ public:
         , _account(account)
     {
         qRegisterMetaType<PropagatorJob::AbortType>("PropagatorJob::AbortType");
+        s_propagators.append(this);
     }
 
     ~OwncloudPropagator();
@@ -426,6 +433,19 @@ public:
     /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
     int maximumActiveTransferJob();
 
+    /** Adjusts the number of parallel jobs, see ConcurrencyController.
+     *
+     * Called by each item job once it is done.
+     */
+    void reportJobFinished(const SyncFileItem &item, bool likelyFinishedQuickly, qint64 durationMsecs);
+
+    /** Reschedules the propagators of concurrent syncs that wait for room in
+     * the shared job budget, except \a except.
+     *
+     * Called whenever jobs stop counting against the budget.
+     */
+    static void wakeJobBudgetWaiters(const OwncloudPropagator *except = nullptr);
+
     /** The size to use for upload chunks.
      *
      * Will be dynamically adjusted after each chunk upload finishes
@@ -438,6 +458,12 @@ public:
     /* The maximum number of active jobs in parallel  */
     int hardMaximumActiveJob();
 
+    /** The maximum number of parallel network jobs for the given account and options.
+     *
+     * Also used by the discovery phase, which runs before the propagator exists.
+     */
+    static int hardMaximumActiveJob(const AccountPtr &account, const SyncOptions &syncOptions);
+
     /** Check whether a download would clash with an existing file
      * in filesystems that are only case-preserving.
      */
@@ -522,8 +548,10 @@ private slots:
     /** Emit the finished signal and make sure it is only emitted once */
     void emitFinished(SyncFileItem::Status status)
     {
-        if (!_finishedEmited)
+        if (!_finishedEmited) {
+            saveLearnedConcurrency();
             emit finished(status == SyncFileItem::Success);
+        }
         _finishedEmited = true;
     }
 
@@ -549,9 +577,20 @@ signals:
     void insufficientRemoteStorage();
 
 private:
+    /** Remembers the parallelism this sync settled on in the account */
+    void saveLearnedConcurrency();
+
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
     SyncOptions _syncOptions;
+    ConcurrencyController _concurrency;
+    // Bytes of the running transfers already credited to _concurrency
+    QHash<const SyncFileItem *, quint64> _creditedTransferBytes;
+
+    // Propagators of concurrent syncs share hardMaximumActiveJob(), see
+    // scheduleNextJobImpl(). Set when the others use up the whole budget.
+    bool _waitingForJobBudget = false;
+    static QList<OwncloudPropagator *> s_propagators;
 };
 
 
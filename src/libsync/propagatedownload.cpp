@@ -31,6 +31,7 @@
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <algorithm>
 #include <cmath>
 
 #ifdef Q_OS_UNIX
@@ -42,6 +43,9 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcGetJob, "nextcloud.sync.networkjob.get", QtInfoMsg)
 Q_LOGGING_CATEGORY(lcPropagateDownload, "nextcloud.sync.propagator.download", QtInfoMsg)
 
+// Upper bound for the block size GETFileJob writes to the device
+static const qint64 writeBufferSize = 1024 * 1024;
+
 // Always coming in with forward slashes.
 // In csync_excluded_no_ctx we ignore all files with longer than 254 chars
 // This function also adds a dot at the beginning of the filename to hide the file on OS X and Linux
@@ -109,7 +113,11 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
+    if (_rangeEnd > 0) {
+        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-' + QByteArray::number(_rangeEnd - 1);
+        _headers["Accept-Ranges"] = "bytes";
+        qCDebug(lcGetJob) << "Get range " << _headers["Range"];
+    } else if (_resumeStart > 0) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
@@ -197,16 +205,18 @@ void GETFileJob::slotMetaDataChanged()
     }
 
     quint64 start = 0;
+    quint64 end = 0;
     QByteArray ranges = reply()->rawHeader("Content-Range");
     if (!ranges.isEmpty()) {
-        QRegExp rx("bytes (\\d+)-");
+        QRegExp rx("bytes (\\d+)-(\\d+)");
         if (rx.indexIn(ranges) >= 0) {
             start = rx.cap(1).toULongLong();
+            end = rx.cap(2).toULongLong() + 1;
         }
     }
     if (start != _resumeStart) {
         qCWarning(lcGetJob) << "Wrong content-range: " << ranges << " while expecting start was" << _resumeStart;
-        if (ranges.isEmpty()) {
+        if (ranges.isEmpty() && _allowWholeFile) {
             // device doesn't support range, just try again from scratch
             _device->close();
             if (!_device->open(QIODevice::WriteOnly)) {
@@ -223,13 +233,61 @@ void GETFileJob::slotMetaDataChanged()
             return;
         }
     }
+    // A shorter range than requested is caught by the caller when it
+    // finds the range incomplete.
+    _rangeConfirmed = _rangeEnd > 0 && !ranges.isEmpty() && end <= _rangeEnd;
+    if (_rangeEnd > 0 && !_rangeConfirmed && (!ranges.isEmpty() || !_allowWholeFile)) {
+        qCWarning(lcGetJob) << "Wrong content-range: " << ranges << " while expecting end was" << _rangeEnd;
+        _errorString = tr("Server returned wrong content-range");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
 
     auto lastModified = reply()->header(QNetworkRequest::LastModifiedHeader);
     if (!lastModified.isNull()) {
         _lastModified = Utility::qDateTimeToTime_t(lastModified.toDateTime());
     }
 
+    _inFlightCalculators.clear();
+    if (_resumeStart == 0 && !_rangeConfirmed && _computeChecksumsInFlight) {
+        auto types = _inFlightChecksumTypes;
+        auto transmissionType = parseChecksumHeaderType(transmissionChecksumHeader());
+        if (!transmissionType.isEmpty() && !types.contains(transmissionType))
+            types.append(transmissionType);
+        for (const auto &type : types) {
+            std::unique_ptr<ChecksumCalculator> calculator(new ChecksumCalculator(type));
+            if (calculator->isValid())
+                _inFlightCalculators.push_back(std::move(calculator));
+        }
+    }
+
+    // Small bodies don't need the whole write buffer
+    const qint64 contentLength = reply()->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    _writeBuffer.resize(contentLength > 0 ? qMin(contentLength, writeBufferSize) : writeBufferSize);
+    _writeBufferUsed = 0;
+
     _saveBodyToFile = true;
+    emit bodyStarted();
+}
+
+QByteArray GETFileJob::transmissionChecksumHeader() const
+{
+    if (!reply())
+        return QByteArray();
+    auto checksumHeader = findBestChecksum(reply()->rawHeader(checkSumHeaderC));
+    auto contentMd5Header = reply()->rawHeader(contentMd5HeaderC);
+    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
+        checksumHeader = "MD5:" + contentMd5Header;
+    return checksumHeader;
+}
+
+QMap<QByteArray, QByteArray> GETFileJob::inFlightChecksums() const
+{
+    QMap<QByteArray, QByteArray> checksums;
+    for (const auto &calculator : _inFlightCalculators)
+        checksums.insert(calculator->checksumType(), calculator->result());
+    return checksums;
 }
 
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
@@ -258,35 +316,55 @@ void GETFileJob::giveBandwidthQuota(qint64 q)
 
 qint64 GETFileJob::currentDownloadPosition()
 {
-    if (_device && _device->pos() > 0 && _device->pos() > qint64(_resumeStart)) {
-        return _device->pos();
+    if (_device && _device->pos() + _writeBufferUsed > qint64(_resumeStart)) {
+        return _device->pos() + _writeBufferUsed;
     }
     return _resumeStart;
 }
 
+bool GETFileJob::flushWriteBuffer()
+{
+    if (_writeBufferUsed == 0)
+        return true;
+    const qint64 w = _device->write(_writeBuffer.constData(), _writeBufferUsed);
+    if (w != _writeBufferUsed) {
+        _errorString = _device->errorString();
+        _errorStatus = SyncFileItem::NormalError;
+        qCWarning(lcGetJob) << "Error while writing to file" << w << _writeBufferUsed << _errorString;
+        _writeBufferUsed = 0;
+        return false;
+    }
+    _writeBufferUsed = 0;
+    return true;
+}
+
 void GETFileJob::slotReadyRead()
 {
     if (!reply())
         return;
-    int bufferSize = qMin(1024 * 8ll, reply()->bytesAvailable());
-    QByteArray buffer(bufferSize, Qt::Uninitialized);
+    if (_writeBuffer.isEmpty()) {
+        // Only an error body is read, it is not saved
+        _writeBuffer.resize(16 * 1024);
+    }
 
+    // The reply only buffers a few KiB for the bandwidth limiting. The data
+    // is collected in _writeBuffer and written once it is full or the
+    // reply finished, so big downloads aren't written in tiny pieces.
     while (reply()->bytesAvailable() > 0) {
         if (_bandwidthChoked) {
             qCWarning(lcGetJob) << "Download choked";
             break;
         }
-        qint64 toRead = bufferSize;
+        qint64 toRead = _writeBuffer.size() - _writeBufferUsed;
         if (_bandwidthLimited) {
-            toRead = qMin(qint64(bufferSize), _bandwidthQuota);
+            toRead = qMin(toRead, _bandwidthQuota);
             if (toRead == 0) {
                 qCWarning(lcGetJob) << "Out of quota";
                 break;
             }
-            _bandwidthQuota -= toRead;
         }
 
-        qint64 r = reply()->read(buffer.data(), toRead);
+        qint64 r = reply()->read(_writeBuffer.data() + _writeBufferUsed, toRead);
         if (r < 0) {
             _errorString = networkReplyErrorString(*reply());
             _errorStatus = SyncFileItem::NormalError;
@@ -294,21 +372,31 @@ void GETFileJob::slotReadyRead()
             reply()->abort();
             return;
         }
+        if (_bandwidthLimited) {
+            _bandwidthQuota -= r;
+        }
 
-        if (_device->isOpen() && _saveBodyToFile) {
-            qint64 w = _device->write(buffer.constData(), r);
-            if (w != r) {
-                _errorString = _device->errorString();
-                _errorStatus = SyncFileItem::NormalError;
-                qCWarning(lcGetJob) << "Error while writing to file" << w << r << _errorString;
-                reply()->abort();
-                return;
-            }
+        if (!_device->isOpen() || !_saveBodyToFile)
+            continue;
+
+        if (_rangeConfirmed) {
+            // Never write beyond the range, the next one may already be there
+            r = qBound<qint64>(0, qint64(_rangeEnd) - _device->pos() - _writeBufferUsed, r);
+        }
+        for (const auto &calculator : _inFlightCalculators)
+            calculator->addData(_writeBuffer.constData() + _writeBufferUsed, r);
+        _writeBufferUsed += r;
+
+        if (_writeBufferUsed == _writeBuffer.size() && !flushWriteBuffer()) {
+            reply()->abort();
+            return;
         }
     }
 
     if (reply()->isFinished() && reply()->bytesAvailable() == 0) {
         qCDebug(lcGetJob) << "Actually finished!";
+        if (_device->isOpen())
+            flushWriteBuffer(); // see finished()
         if (_bandwidthManager) {
             _bandwidthManager->unregisterDownloadJob(this);
         }
@@ -439,6 +527,7 @@ void PropagateDownloadFile::startDownload()
 
     QString tmpFileName;
     QByteArray expectedEtagForResume;
+    QVector<QPair<quint64, quint64>> savedRanges;
     const SyncJournalDb::DownloadInfo progressInfo = propagator()->_journal->getDownloadInfo(_item->_file);
     if (progressInfo._valid) {
         // if the etag has changed meanwhile, remove the already downloaded part.
@@ -448,6 +537,7 @@ void PropagateDownloadFile::startDownload()
         } else {
             tmpFileName = progressInfo._tmpfile;
             expectedEtagForResume = progressInfo._etag;
+            savedRanges = progressInfo._ranges;
         }
     }
 
@@ -456,21 +546,58 @@ void PropagateDownloadFile::startDownload()
     }
 
     _tmpFile.setFileName(propagator()->getFilePath(tmpFileName));
-    if (!_tmpFile.open(QIODevice::Append | QIODevice::Unbuffered)) {
+
+    // The temporary file of a download in ranges has its final size from the
+    // start, only the ranges tell what was downloaded already.
+    const qint64 existingSize = QFileInfo(_tmpFile.fileName()).size();
+    if (!savedRanges.isEmpty() && existingSize != qint64(_item->_size)) {
+        qCWarning(lcPropagateDownload) << "Temporary file has the wrong size for the saved ranges, starting over" << existingSize;
+        savedRanges.clear();
+        FileSystem::remove(_tmpFile.fileName());
+    }
+    const bool inRanges = !savedRanges.isEmpty()
+        || (downloadRangeCount() > 1 && QFileInfo(_tmpFile.fileName()).size() == 0);
+
+    const QIODevice::OpenMode openMode = inRanges ? QIODevice::ReadWrite : QIODevice::Append;
+    if (!_tmpFile.open(openMode | QIODevice::Unbuffered)) {
         done(SyncFileItem::NormalError, _tmpFile.errorString());
         return;
     }
 
     FileSystem::setFileHidden(_tmpFile.fileName(), true);
 
-    _resumeStart = _tmpFile.size();
-    if (_resumeStart > 0) {
-        if (_resumeStart == _item->_size) {
-            qCInfo(lcPropagateDownload) << "File is already complete, no need to download";
+    _ranges.clear();
+    if (inRanges) {
+        for (const auto &savedRange : savedRanges) {
+            DownloadRange range;
+            range.start = savedRange.first;
+            range.end = savedRange.second;
+            _ranges.append(range);
+        }
+        _resumeStart = _item->_size - missingRangeBytes();
+        if (!_ranges.isEmpty() && _resumeStart == _item->_size) {
+            qCInfo(lcPropagateDownload) << "All ranges are complete, no need to download";
             _tmpFile.close();
             downloadFinished();
             return;
         }
+    } else {
+        _resumeStart = _tmpFile.size();
+        if (_resumeStart > 0 && _resumeStart == _item->_size && _isEncrypted) {
+            // The decryption never finished: installing this file would put
+            // the ciphertext in place
+            qCInfo(lcPropagateDownload) << "Encrypted file is complete but was not decrypted, downloading it again";
+            _tmpFile.resize(0);
+            _resumeStart = 0;
+        }
+        if (_resumeStart > 0) {
+            if (_resumeStart == _item->_size) {
+                qCInfo(lcPropagateDownload) << "File is already complete, no need to download";
+                _tmpFile.close();
+                downloadFinished();
+                return;
+            }
+        }
     }
 
     // If there's not enough space to fully download this file, stop.
@@ -496,15 +623,56 @@ void PropagateDownloadFile::startDownload()
         return;
     }
 
+    if (inRanges && _ranges.isEmpty()) {
+        // Split the file into equally sized ranges and give the file its
+        // final size, each range is written at its own offset.
+        const int count = downloadRangeCount();
+        const quint64 rangeSize = _item->_size / count;
+        for (int i = 0; i < count; ++i) {
+            DownloadRange range;
+            range.start = i * rangeSize;
+            range.end = i == count - 1 ? _item->_size : (i + 1) * rangeSize;
+            _ranges.append(range);
+        }
+        if (!_tmpFile.resize(_item->_size)) {
+            done(SyncFileItem::NormalError, _tmpFile.errorString());
+            _tmpFile.remove();
+            return;
+        }
+    }
+
+    // Files written in several blocks are kept from being fragmented on
+    // disk; failing is harmless.
+    if (_item->_size > quint64(writeBufferSize)) {
+        FileSystem::preallocate(_tmpFile, _item->_size);
+    }
+
     {
         SyncJournalDb::DownloadInfo pi;
         pi._etag = _item->_etag;
         pi._tmpfile = tmpFileName;
         pi._valid = true;
+        for (const auto &range : _ranges)
+            pi._ranges.append(qMakePair(range.start, range.end));
         propagator()->_journal->setDownloadInfo(_item->_file, pi);
         propagator()->_journal->commit("download file start");
     }
 
+    if (inRanges) {
+        // Only the first range is started until the server confirms that it
+        // supports ranges, see slotFirstRangeBodyStarted().
+        for (int i = 0; i < _ranges.size(); ++i) {
+            if (_ranges[i].start != _ranges[i].end) {
+                if (startRange(i, /*allowWholeFile=*/true)) {
+                    _job = _ranges[i].job;
+                    connect(_job.data(), &GETFileJob::bodyStarted, this, &PropagateDownloadFile::slotFirstRangeBodyStarted);
+                }
+                break;
+            }
+        }
+        return;
+    }
+
     QMap<QByteArray, QByteArray> headers;
 
     if (_item->_directDownloadUrl.isEmpty()) {
@@ -526,15 +694,195 @@ void PropagateDownloadFile::startDownload()
             &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    QList<QByteArray> inFlightChecksumTypes;
+    if (!contentChecksumType().isEmpty())
+        inFlightChecksumTypes.append(contentChecksumType());
+    _job->setInFlightChecksumTypes(inFlightChecksumTypes);
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
     connect(_job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
     propagator()->_activeJobList.append(this);
     _job->start();
 }
 
+int PropagateDownloadFile::downloadRangeCount() const
+{
+    // Below this size one request is about as fast
+    static const quint64 minimumRangeSize = 25 * 1000 * 1000;
+
+    static int max = qgetenv("OWNCLOUD_MAX_DOWNLOAD_RANGES").toUInt();
+    const int maxRanges = max ? max : 4;
+
+    // Direct download URLs may not support ranges, and encrypted files are
+    // decrypted from the downloaded file as a whole
+    if (!_item->_directDownloadUrl.isEmpty() || _isEncrypted)
+        return 1;
+    return int(qBound<quint64>(1, _item->_size / minimumRangeSize, maxRanges));
+}
+
+bool PropagateDownloadFile::startRange(int index, bool allowWholeFile)
+{
+    DownloadRange &range = _ranges[index];
+    if (!range.device) {
+        if (allowWholeFile) {
+            // This one may turn into a download of the whole file
+            range.device = &_tmpFile;
+        } else {
+            range.device = new QFile(_tmpFile.fileName(), this);
+        }
+    }
+    if ((!range.device->isOpen() && !range.device->open(QIODevice::ReadWrite | QIODevice::Unbuffered))
+        || !range.device->seek(range.start)) {
+        qCWarning(lcPropagateDownload) << "Could not open" << range.device->fileName() << "for range" << range.start;
+        const QString error = range.device->errorString();
+        abortRanges();
+        saveRangeProgress();
+        done(SyncFileItem::NormalError, error);
+        return false;
+    }
+
+    GETFileJob *job = new GETFileJob(propagator()->account(),
+        propagator()->_remoteFolder + _item->_file,
+        range.device, QMap<QByteArray, QByteArray>(), _item->_etag, range.start, this);
+    job->setRangeEnd(range.end, allowWholeFile);
+    job->setBandwidthManager(&propagator()->_bandwidthManager);
+    if (allowWholeFile && range.start == 0) {
+        // Only used if the server sends the whole file
+        QList<QByteArray> inFlightChecksumTypes;
+        if (!contentChecksumType().isEmpty())
+            inFlightChecksumTypes.append(contentChecksumType());
+        job->setInFlightChecksumTypes(inFlightChecksumTypes);
+    }
+    connect(job, &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
+    connect(job, &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
+    range.job = job;
+    propagator()->_activeJobList.append(this);
+    job->start();
+    return true;
+}
+
+void PropagateDownloadFile::startNextRanges()
+{
+    for (int i = 0; i < _ranges.size(); ++i) {
+        const DownloadRange &range = _ranges[i];
+        if (range.job || range.start == range.end)
+            continue;
+        // Keep one range going even if the other jobs use up the whole budget
+        const bool anyRunning = std::any_of(_ranges.cbegin(), _ranges.cend(),
+            [](const DownloadRange &r) { return !r.job.isNull(); });
+        if (anyRunning && propagator()->_activeJobList.count() >= propagator()->maximumActiveTransferJob())
+            return;
+        if (!startRange(i, /*allowWholeFile=*/false))
+            return;
+    }
+}
+
+void PropagateDownloadFile::slotFirstRangeBodyStarted()
+{
+    if (!_job || _ranges.isEmpty())
+        return;
+    if (_job->rangeConfirmed()) {
+        startNextRanges();
+        return;
+    }
+
+    // The server sent the whole file. It is written from the start of the
+    // temporary file, which continues as a download in one piece.
+    qCInfo(lcPropagateDownload) << "Server does not support ranges, downloading" << _item->_file << "in one piece";
+    _ranges.clear();
+    _resumeStart = 0;
+    _downloadProgress = 0;
+    _tmpFile.resize(0);
+
+    auto pi = propagator()->_journal->getDownloadInfo(_item->_file);
+    if (pi._valid) {
+        pi._ranges.clear();
+        propagator()->_journal->setDownloadInfo(_item->_file, pi);
+    }
+}
+
+bool PropagateDownloadFile::rangeFinished(GETFileJob *job)
+{
+    auto it = std::find_if(_ranges.begin(), _ranges.end(),
+        [job](const DownloadRange &range) { return range.job == job; });
+    if (it == _ranges.end())
+        return true;
+    DownloadRange &range = *it;
+    range.start = rangePosition(range);
+    range.job.clear();
+    if (range.device != &_tmpFile)
+        range.device->close();
+
+    if (job->reply()->error() != QNetworkReply::NoError || job->errorStatus() != SyncFileItem::NoStatus) {
+        abortRanges();
+        saveRangeProgress();
+        return true;
+    }
+
+    if (range.start != range.end) {
+        qCWarning(lcPropagateDownload) << "Range of" << _item->_file << "ended at" << range.start << "instead of" << range.end;
+        abortRanges();
+        saveRangeProgress();
+        propagator()->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
+        return false;
+    }
+
+    saveRangeProgress();
+    if (missingRangeBytes() > 0) {
+        startNextRanges();
+        return false;
+    }
+    return true;
+}
+
+void PropagateDownloadFile::abortRanges()
+{
+    for (auto &range : _ranges) {
+        if (!range.job)
+            continue;
+        GETFileJob *job = range.job;
+        range.start = rangePosition(range);
+        range.job.clear();
+        // Aborting may finish the job right away, it must not come back here
+        disconnect(job, nullptr, this, nullptr);
+        if (job->reply())
+            job->reply()->abort();
+        propagator()->_activeJobList.removeOne(this);
+    }
+}
+
+void PropagateDownloadFile::saveRangeProgress()
+{
+    auto pi = propagator()->_journal->getDownloadInfo(_item->_file);
+    if (!pi._valid)
+        return;
+    pi._ranges.clear();
+    for (const auto &range : _ranges)
+        pi._ranges.append(qMakePair(rangePosition(range), range.end));
+    propagator()->_journal->setDownloadInfo(_item->_file, pi);
+    propagator()->_journal->commitPeriodically("download range");
+}
+
+quint64 PropagateDownloadFile::rangePosition(const DownloadRange &range) const
+{
+    if (range.job && range.device && range.device->isOpen())
+        return qBound<quint64>(range.start, range.device->pos(), range.end);
+    return range.start;
+}
+
+quint64 PropagateDownloadFile::missingRangeBytes() const
+{
+    quint64 missing = 0;
+    for (const auto &range : _ranges)
+        missing += range.end - rangePosition(range);
+    return missing;
+}
+
 qint64 PropagateDownloadFile::committedDiskSpace() const
 {
     if (_state == Running) {
+        if (!_ranges.isEmpty())
+            return missingRangeBytes();
         return qBound(0ULL, _item->_size - _resumeStart - _downloadProgress, _item->_size);
     }
     return 0;
@@ -550,11 +898,15 @@ void PropagateDownloadFile::slotGetFinished()
 {
     propagator()->_activeJobList.removeOne(this);
 
-    GETFileJob *job = _job;
+    GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     ASSERT(job);
 
+    if (!_ranges.isEmpty() && !rangeFinished(job))
+        return;
+
     QNetworkReply::NetworkError err = job->reply()->error();
-    if (err != QNetworkReply::NoError) {
+    // Writing the end of the body may fail after the reply finished
+    if (err != QNetworkReply::NoError || job->errorStatus() != SyncFileItem::NoStatus) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
         // If we sent a 'Range' header and get 416 back, we want to retry
@@ -579,7 +931,7 @@ void PropagateDownloadFile::slotGetFinished()
 
         // Don't keep the temporary file if it is empty or we
         // used a bad range header or the file's not on the server anymore.
-        if (_tmpFile.size() == 0 || badRangeHeader || fileNotFound) {
+        if ((_tmpFile.size() == 0 && _ranges.isEmpty()) || badRangeHeader || fileNotFound) {
             _tmpFile.close();
             FileSystem::remove(_tmpFile.fileName());
             propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
@@ -646,7 +998,11 @@ void PropagateDownloadFile::slotGetFinished()
     const QByteArray sizeHeader("Content-Length");
     quint64 bodySize = job->reply()->rawHeader(sizeHeader).toULongLong();
 
-    if (!job->reply()->rawHeader(sizeHeader).isEmpty() && _tmpFile.size() > 0 && bodySize == 0) {
+    // For ranges the Content-Length only covers the last one, each range was
+    // checked to be complete already.
+    const bool singleBody = _ranges.isEmpty();
+
+    if (singleBody && !job->reply()->rawHeader(sizeHeader).isEmpty() && _tmpFile.size() > 0 && bodySize == 0) {
         // Strange bug with broken webserver or webfirewall https://github.com/owncloud/client/issues/3373#issuecomment-122672322
         // This happened when trying to resume a file. The Content-Range header was files, Content-Length was == 0
         qCDebug(lcPropagateDownload) << bodySize << _item->_size << _tmpFile.size() << job->resumeStart();
@@ -655,7 +1011,7 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
-    if (bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart()) {
+    if (singleBody && bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart()) {
         qCDebug(lcPropagateDownload) << bodySize << _tmpFile.size() << job->resumeStart();
         propagator()->_anotherSyncNeeded = true;
         done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
@@ -679,9 +1035,9 @@ void PropagateDownloadFile::slotGetFinished()
     if (job->reply()->rawHeader("OC-Conflict") == "1") {
         _conflictRecord.path = _item->_file.toUtf8();
         _conflictRecord.baseFileId = job->reply()->rawHeader("OC-ConflictBaseFileId");
-        _conflictRecord.baseEtag = _job->reply()->rawHeader("OC-ConflictBaseEtag");
+        _conflictRecord.baseEtag = job->reply()->rawHeader("OC-ConflictBaseEtag");
 
-        auto mtimeHeader = _job->reply()->rawHeader("OC-ConflictBaseMtime");
+        auto mtimeHeader = job->reply()->rawHeader("OC-ConflictBaseMtime");
         if (!mtimeHeader.isEmpty())
             _conflictRecord.baseModtime = mtimeHeader.toLongLong();
 
@@ -698,11 +1054,10 @@ void PropagateDownloadFile::slotGetFinished()
         this, &PropagateDownloadFile::transmissionChecksumValidated);
     connect(validator, &ValidateChecksumHeader::validationFailed,
         this, &PropagateDownloadFile::slotChecksumFail);
-    auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
-    auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
-    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
-        checksumHeader = "MD5:" + contentMd5Header;
-    validator->start(_tmpFile.fileName(), checksumHeader);
+    // The checksums were computed while the data was written, so the file
+    // usually doesn't need to be read again.
+    _inFlightChecksums = job->inFlightChecksums();
+    validator->start(_tmpFile.fileName(), job->transmissionChecksumHeader(), _inFlightChecksums);
 }
 
 void PropagateDownloadFile::slotChecksumFail(const QString &errMsg)
@@ -822,6 +1177,12 @@ void PropagateDownloadFile::transmissionChecksumValidated(const QByteArray &chec
         return contentChecksumComputed(checksumType, checksum);
     }
 
+    // Use the content checksum computed during the download if available.
+    auto inFlight = _inFlightChecksums.constFind(theContentChecksumType);
+    if (inFlight != _inFlightChecksums.constEnd()) {
+        return contentChecksumComputed(theContentChecksumType, *inFlight);
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(theContentChecksumType);
@@ -836,12 +1197,19 @@ void PropagateDownloadFile::contentChecksumComputed(const QByteArray &checksumTy
     _item->_checksumHeader = makeChecksumHeader(checksumType, checksum);
 
     if (_isEncrypted) {
-        if (_downloadEncryptedHelper->decryptFile(_tmpFile)) {
-          downloadFinished();
-        } else {
-          done(SyncFileItem::NormalError, _downloadEncryptedHelper->errorString());
-        }
-
+        _tmpFile.close();
+        connect(_downloadEncryptedHelper, &PropagateDownloadEncrypted::decryptionFinished, this, [this] {
+            // Let's fool the rest of the logic into thinking this was the actual download
+            _tmpFile.setFileName(_downloadEncryptedHelper->decryptedFileName());
+            downloadFinished();
+        });
+        connect(_downloadEncryptedHelper, &PropagateDownloadEncrypted::decryptionFailed, this, [this] {
+            // Like a broken checksum: don't resume from the encrypted file
+            FileSystem::remove(_tmpFile.fileName());
+            propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+            done(SyncFileItem::NormalError, _downloadEncryptedHelper->errorString());
+        });
+        _downloadEncryptedHelper->decryptFile(_tmpFile.fileName());
     } else {
         downloadFinished();
     }
@@ -973,6 +1341,10 @@ void PropagateDownloadFile::updateMetadata(bool isConflict)
 
 void PropagateDownloadFile::slotDownloadProgress(qint64 received, qint64)
 {
+    if (!_ranges.isEmpty()) {
+        propagator()->reportProgress(*_item, _item->_size - missingRangeBytes());
+        return;
+    }
     if (!_job)
         return;
     _downloadProgress = received;
@@ -984,6 +1356,11 @@ void PropagateDownloadFile::abort(PropagatorJob::AbortType abortType)
 {
     if (_job && _job->reply())
         _job->reply()->abort();
+    for (int i = 0; i < _ranges.size(); ++i) {
+        GETFileJob *job = _ranges[i].job;
+        if (job && job->reply())
+            job->reply()->abort();
+    }
 
     if (abortType == AbortType::Asynchronous) {
         emit abortFinished();
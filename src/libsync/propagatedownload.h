@@ -16,10 +16,13 @@
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
 #include "clientsideencryption.h"
+#include "common/checksums.h"
 
 #include <QBuffer>
 #include <QFile>
 
+#include <vector>
+
 namespace OCC {
 class PropagateDownloadEncrypted;
 
@@ -35,6 +38,9 @@ class GETFileJob : public AbstractNetworkJob
     QString _errorString;
     QByteArray _expectedEtagForResume;
     quint64 _resumeStart;
+    quint64 _rangeEnd = 0; // see setRangeEnd()
+    bool _rangeConfirmed = false;
+    bool _allowWholeFile = true;
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
@@ -48,6 +54,15 @@ class GETFileJob : public AbstractNetworkJob
     /// Will be set to true once we've seen a 2xx response header
     bool _saveBodyToFile = false;
 
+    /// The body is collected here and written to the device in large blocks
+    QByteArray _writeBuffer;
+    qint64 _writeBufferUsed = 0;
+
+    /// Checksum types to compute while the body is written, see setInFlightChecksumTypes()
+    QList<QByteArray> _inFlightChecksumTypes;
+    bool _computeChecksumsInFlight = false;
+    std::vector<std::unique_ptr<ChecksumCalculator>> _inFlightCalculators;
+
 public:
     // DOES NOT take ownership of the device.
     explicit GETFileJob(AccountPtr account, const QString &path, QFile *device,
@@ -70,6 +85,11 @@ public:
         if (reply()->bytesAvailable()) {
             return false;
         } else {
+            // The reply can't be aborted anymore, a write error is
+            // reported through errorStatus()
+            if (_device->isOpen()) {
+                flushWriteBuffer();
+            }
             if (_bandwidthManager) {
                 _bandwidthManager->unregisterDownloadJob(this);
             }
@@ -87,6 +107,7 @@ public:
     void setChoked(bool c);
     void setBandwidthLimited(bool b);
     void giveBandwidthQuota(qint64 q);
+    qint64 bandwidthQuota() const { return _bandwidthQuota; }
     qint64 currentDownloadPosition();
 
     QString errorString() const;
@@ -99,15 +120,57 @@ public:
 
     QByteArray &etag() { return _etag; }
     quint64 resumeStart() { return _resumeStart; }
+
+    /**
+     * Only request the bytes before \a end, starting at resumeStart.
+     *
+     * If the server ignores the range and sends the whole file, it is
+     * written to the device from the start like for a failed resume if
+     * \a allowWholeFile is set, otherwise the job fails.
+     * rangeConfirmed() tells the cases apart.
+     */
+    void setRangeEnd(quint64 end, bool allowWholeFile)
+    {
+        _rangeEnd = end;
+        _allowWholeFile = allowWholeFile;
+    }
+    quint64 rangeEnd() const { return _rangeEnd; }
+    /// Whether the server replied with exactly the requested range
+    bool rangeConfirmed() const { return _rangeConfirmed; }
     time_t lastModified() { return _lastModified; }
 
+    /// The best transmission checksum header sent by the server, may be empty
+    QByteArray transmissionChecksumHeader() const;
+
+    /**
+     * Checksum types that should be computed from the body as it is written
+     * to the device. The transmission checksum type announced in the reply
+     * headers is always added to these.
+     *
+     * Nothing is computed for resumed downloads and for ranges since the
+     * rest of the file is not seen by this job.
+     */
+    void setInFlightChecksumTypes(const QList<QByteArray> &types)
+    {
+        _inFlightChecksumTypes = types;
+        _computeChecksumsInFlight = true;
+    }
+
+    /// Checksums computed while downloading, by type. Empty if none were computed.
+    QMap<QByteArray, QByteArray> inFlightChecksums() const;
+
 
 signals:
     void finishedSignal();
     void downloadProgress(qint64, qint64);
+    /// Emitted once the reply headers were accepted and before the body is written
+    void bodyStarted();
 private slots:
     void slotReadyRead();
     void slotMetaDataChanged();
+
+private:
+    bool flushWriteBuffer();
 };
 
 /**
@@ -128,7 +191,7 @@ private slots:
     |                         checksum differs?    |
     +-> startDownload() <--------------------------+
           |                                        |
-          +-> run a GETFileJob                     | checksum identical?
+          +-> run a GETFileJob, or one per range   | checksum identical?
                                                    |
       done?-> slotGetFinished()                    |
                 |                                  |
@@ -184,6 +247,8 @@ private slots:
     void startDownload();
     /// Called when the GETFileJob finishes
     void slotGetFinished();
+    /// Called when the first range's reply tells whether the server honors ranges
+    void slotFirstRangeBodyStarted();
     /// Called when the download's checksum header was validated
     void transmissionChecksumValidated(const QByteArray &checksumType, const QByteArray &checksum);
     /// Called when the download's checksum computation is done
@@ -197,13 +262,36 @@ private slots:
     void slotChecksumFail(const QString &errMsg);
 
 private:
+    /// A part of the file that is downloaded with its own GETFileJob
+    struct DownloadRange
+    {
+        quint64 start = 0; // next offset to download
+        quint64 end = 0;
+        QPointer<GETFileJob> job;
+        QFile *device = nullptr;
+    };
+
     void startAfterIsEncryptedIsChecked();
     void deleteExistingFolder();
 
+    /// How many ranges the file should be split into, 1 to download it in one piece
+    int downloadRangeCount() const;
+    bool startRange(int index, bool allowWholeFile);
+    /// Starts more of the pending ranges while the propagator has room for them
+    void startNextRanges();
+    /// Returns true if the job's result should be handled like the one of a single GET
+    bool rangeFinished(GETFileJob *job);
+    void abortRanges();
+    void saveRangeProgress();
+    quint64 rangePosition(const DownloadRange &range) const;
+    quint64 missingRangeBytes() const;
+
     quint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
+    QVector<DownloadRange> _ranges; // empty if the file is downloaded in one piece
     QFile _tmpFile;
+    QMap<QByteArray, QByteArray> _inFlightChecksums;
     bool _deleteExisting;
     bool _isEncrypted = false;
     EncryptedFile _encryptedInfo;
@@ -99,32 +99,42 @@ void PropagateDownloadEncrypted::checkFolderEncryptedMetadata(const QJsonDocumen
 // TODO: Fix this. Exported in the wrong place.
 QString createDownloadTmpFileName(const QString &previous);
 
-bool PropagateDownloadEncrypted::decryptFile(QFile& tmpFile)
+void PropagateDownloadEncrypted::decryptFile(const QString &encryptedFileName)
 {
     const QString tmpFileName = createDownloadTmpFileName(_item->_file + QLatin1String("_dec"));
     qCDebug(lcPropagateDownloadEncrypted) << "Content Checksum Computed starting decryption" << tmpFileName;
 
-    tmpFile.close();
-    QFile _tmpOutput(_propagator->getFilePath(tmpFileName), this);
-    EncryptionHelper::fileDecryption(_encryptedInfo.encryptionKey,
-                                     _encryptedInfo.initializationVector,
-                                     &tmpFile,
-                                     &_tmpOutput);
+    _encryptedFileName = encryptedFileName;
+    _decryptedFileName = _propagator->getFilePath(tmpFileName);
 
-    qCDebug(lcPropagateDownloadEncrypted) << "Decryption finished" << tmpFile.fileName() << _tmpOutput.fileName();
-
-    tmpFile.close();
-    _tmpOutput.close();
+    // Large files take a while to decrypt, do it in a worker thread
+    auto job = new FileEncryptionJob(FileEncryptionJob::Decrypt,
+        _encryptedInfo.encryptionKey,
+        _encryptedInfo.initializationVector,
+        _encryptedFileName, _decryptedFileName, this);
+    connect(job, &FileEncryptionJob::finished, this, &PropagateDownloadEncrypted::slotFileDecrypted);
+    job->start();
+}
 
-    // we decripted the temporary into another temporary, so good bye old one
-    if (!tmpFile.remove()) {
-        qCDebug(lcPropagateDownloadEncrypted) << "Failed to remove temporary file" << tmpFile.errorString();
-        _errorString = tmpFile.errorString();
-        return false;
+void PropagateDownloadEncrypted::slotFileDecrypted(bool success)
+{
+    sender()->deleteLater();
+    qCDebug(lcPropagateDownloadEncrypted) << "Decryption finished" << success << _encryptedFileName << _decryptedFileName;
+
+    if (!success) {
+        _errorString = tr("The file could not be decrypted.");
+        QFile::remove(_decryptedFileName);
+        emit decryptionFailed();
+        return;
     }
 
-    // Let's fool the rest of the logic into thinking this was the actual download
-    tmpFile.setFileName(_tmpOutput.fileName());
+    // we decripted the temporary into another temporary, so good bye old one.
+    // The decrypted file is fine even if that fails: a leftover encrypted
+    // file is never installed, see PropagateDownloadFile::startDownload().
+    QFile encryptedFile(_encryptedFileName);
+    if (!encryptedFile.remove()) {
+        qCWarning(lcPropagateDownloadEncrypted) << "Failed to remove temporary file" << encryptedFile.errorString();
+    }
 
     //TODO: This seems what's breaking the logic.
     // Let's fool the rest of the logic into thinking this is the right name of the DAV file
@@ -132,8 +142,12 @@ bool PropagateDownloadEncrypted::decryptFile(QFile& tmpFile)
     _item->_file = _item->_file.section(QLatin1Char('/'), 0, -2)
             + QLatin1Char('/') + _encryptedInfo.originalFilename;
 
+    emit decryptionFinished();
+}
 
-    return true;
+QString PropagateDownloadEncrypted::decryptedFileName() const
+{
+    return _decryptedFileName;
 }
 
 QString PropagateDownloadEncrypted::errorString() const
@@ -18,7 +18,14 @@ public:
   PropagateDownloadEncrypted(OwncloudPropagator *propagator, SyncFileItemPtr item);
   void start();
   void checkFolderId(const QStringList &list);
-  bool decryptFile(QFile& tmpFile);
+  /**
+   * Decrypts the downloaded \a encryptedFileName into another temporary
+   * file in a worker thread. Emits decryptionFinished() or decryptionFailed().
+   * The encrypted file is removed on success.
+   */
+  void decryptFile(const QString &encryptedFileName);
+  /// The temporary file holding the decrypted content, see decryptFile()
+  QString decryptedFileName() const;
   QString errorString() const;
 
 public slots:
@@ -34,6 +41,10 @@ signals:
   void failed();
 
   void decryptionFinished();
+  void decryptionFailed();
+
+private slots:
+  void slotFileDecrypted(bool success);
 
 private:
   OwncloudPropagator *_propagator;
@@ -41,6 +52,8 @@ private:
   QFileInfo _info;
   EncryptedFile _encryptedInfo;
   QString _errorString;
+  QString _encryptedFileName;
+  QString _decryptedFileName;
 };
 
 }
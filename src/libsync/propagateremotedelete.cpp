@@ -134,7 +134,7 @@ void PropagateRemoteDelete::slotDeleteJobFinished()
     }
 
     propagator()->_journal->deleteFileRecord(_item->_originalFile, _item->isDirectory());
-    propagator()->_journal->commit("Remote Remove");
+    propagator()->_journal->commitPeriodically("Remote Remove");
     done(SyncFileItem::Success);
 }
 }
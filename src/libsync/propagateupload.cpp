@@ -272,10 +272,19 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
         return;
     }
 
-    // Compute the content checksum.
+    // Compute the content checksum. If the transmission checksum can't
+    // reuse it, compute that in the same pass over the file.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
+    const auto supportedTransmissionChecksums =
+        propagator()->account()->capabilities().supportedChecksumTypes();
+    const QByteArray transmissionType = transmissionChecksumType();
+    if (!supportedTransmissionChecksums.contains(checksumType) && !transmissionType.isEmpty()) {
+        computeChecksum->setAdditionalChecksumTypes({ transmissionType });
+    }
 
+    connect(computeChecksum, &ComputeChecksum::checksumsComputed,
+        this, [this](const QMap<QByteArray, QByteArray> &checksums) { _computedChecksums = checksums; });
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotComputeTransmissionChecksum);
     connect(computeChecksum, &ComputeChecksum::done,
@@ -295,13 +304,16 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
         return;
     }
 
+    // Maybe it was computed together with the content checksum?
+    const QByteArray transmissionType = transmissionChecksumType();
+    if (_computedChecksums.contains(transmissionType)) {
+        slotStartUpload(transmissionType, _computedChecksums.value(transmissionType));
+        return;
+    }
+
     // Compute the transmission checksum.
     auto computeChecksum = new ComputeChecksum(this);
-    if (uploadChecksumEnabled()) {
-        computeChecksum->setChecksumType(propagator()->account()->capabilities().uploadChecksumType());
-    } else {
-        computeChecksum->setChecksumType(QByteArray());
-    }
+    computeChecksum->setChecksumType(transmissionType);
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotStartUpload);
@@ -311,6 +323,13 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     computeChecksum->start(filePath);
 }
 
+QByteArray PropagateUploadFileCommon::transmissionChecksumType() const
+{
+    if (!uploadChecksumEnabled())
+        return QByteArray();
+    return propagator()->account()->capabilities().uploadChecksumType();
+}
+
 void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionChecksumType, const QByteArray &transmissionChecksum)
 {
     // Remove ourselfs from the list of active job, before any posible call to done()
@@ -388,23 +407,18 @@ UploadDevice::~UploadDevice()
 
 bool UploadDevice::prepareAndOpen(const QString &fileName, qint64 start, qint64 size)
 {
-    _data.clear();
+    _file.close();
     _read = 0;
 
-    QFile file(fileName);
     QString openError;
-    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, start)) {
+    _file.setFileName(fileName);
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, start)) {
         setErrorString(openError);
         return false;
     }
 
-    size = qBound(0ll, size, FileSystem::getSize(fileName) - start);
-    _data.resize(size);
-    auto read = file.read(_data.data(), size);
-    if (read != size) {
-        setErrorString(file.errorString());
-        return false;
-    }
+    _start = start;
+    _size = qBound(0ll, size, FileSystem::getSize(fileName) - start);
 
     return QIODevice::open(QIODevice::ReadOnly);
 }
@@ -418,14 +432,14 @@ qint64 UploadDevice::writeData(const char *, qint64)
 
 qint64 UploadDevice::readData(char *data, qint64 maxlen)
 {
-    if (_data.size() - _read <= 0) {
+    if (_size - _read <= 0) {
         // at end
         if (_bandwidthManager) {
             _bandwidthManager->unregisterUploadDevice(this);
         }
         return -1;
     }
-    maxlen = qMin(maxlen, _data.size() - _read);
+    maxlen = qMin(maxlen, _size - _read);
     if (maxlen == 0) {
         return 0;
     }
@@ -439,9 +453,22 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
         }
         _bandwidthQuota -= maxlen;
     }
-    std::memcpy(data, _data.data() + _read, maxlen);
-    _read += maxlen;
-    return maxlen;
+    if (_file.pos() != _start + _read && !_file.seek(_start + _read)) {
+        setErrorString(_file.errorString());
+        return -1;
+    }
+    auto read = _file.read(data, maxlen);
+    if (read <= 0) {
+        // The file shrank or became unreadable while uploading
+        setErrorString(read < 0 ? _file.errorString() : tr("File ended unexpectedly"));
+        return -1;
+    }
+    if (isBandwidthLimited()) {
+        // Return quota that was not used because of a short read
+        _bandwidthQuota += maxlen - read;
+    }
+    _read += read;
+    return read;
 }
 
 void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
@@ -454,17 +481,17 @@ void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
 
 bool UploadDevice::atEnd() const
 {
-    return _read >= _data.size();
+    return _read >= _size;
 }
 
 qint64 UploadDevice::size() const
 {
-    return _data.size();
+    return _size;
 }
 
 qint64 UploadDevice::bytesAvailable() const
 {
-    return _data.size() - _read + QIODevice::bytesAvailable();
+    return _size - _read + QIODevice::bytesAvailable();
 }
 
 // random access, we can seek
@@ -478,7 +505,7 @@ bool UploadDevice::seek(qint64 pos)
     if (!QIODevice::seek(pos)) {
         return false;
     }
-    if (pos < 0 || pos > _data.size()) {
+    if (pos < 0 || pos > _size) {
         return false;
     }
     _read = pos;
@@ -487,8 +514,8 @@ bool UploadDevice::seek(qint64 pos)
 
 void UploadDevice::giveBandwidthQuota(qint64 bwq)
 {
+    _bandwidthQuota = bwq;
     if (!atEnd()) {
-        _bandwidthQuota = bwq;
         QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection); // tell QNAM that we have quota
     }
 }
@@ -625,6 +652,9 @@ void PropagateUploadFileCommon::slotJobDestroyed(QObject *job)
 // This function is used whenever there is an error occuring and jobs might be in progress
 void PropagateUploadFileCommon::abortWithError(SyncFileItem::Status status, const QString &error)
 {
+    // Aborting the other running chunks calls their finished slots right away,
+    // they must not handle the error again
+    _finished = true;
     abort(AbortType::Synchronous);
     done(status, error);
 }
@@ -696,6 +726,25 @@ void PropagateUploadFileCommon::finalize()
     done(SyncFileItem::Success);
 }
 
+bool PropagateUploadFileCommon::parallelChunkUploadAllowed()
+{
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
+        // Server may also disable parallel chunked upload for any higher version
+        return false;
+    }
+    QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
+    if (!env.isEmpty()) {
+        return env != "false" && env != "0";
+    }
+    int versionNum = propagator()->account()->serverVersionInt();
+    if (versionNum < Account::makeServerVersion(8, 0, 3)) {
+        // Disable parallel chunk upload severs older than 8.0.3 to avoid too many
+        // internal sever errors (#2743, #2938)
+        return false;
+    }
+    return true;
+}
+
 void PropagateUploadFileCommon::abortNetworkJobs(
     PropagatorJob::AbortType abortType,
     const std::function<bool(AbstractNetworkJob *)> &mayAbortJob)
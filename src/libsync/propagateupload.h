@@ -39,7 +39,12 @@ public:
     UploadDevice(BandwidthManager *bwm);
     ~UploadDevice();
 
-    /** Reads the data from the file and opens the device */
+    /**
+     * Opens the file and the device.
+     *
+     * The data is read from the file on demand, so only a small part of the
+     * chunk is ever held in memory.
+     */
     bool prepareAndOpen(const QString &fileName, qint64 start, qint64 size);
 
     qint64 writeData(const char *, qint64) override;
@@ -55,13 +60,17 @@ public:
     void setChoked(bool);
     bool isChoked() { return _choked; }
     void giveBandwidthQuota(qint64 bwq);
+    qint64 bandwidthQuota() const { return _bandwidthQuota; }
 
 signals:
 
 private:
-    // The file data
-    QByteArray _data;
-    // Position in the data
+    // The file the data is streamed from
+    QFile _file;
+    // Offset of the chunk in the file and its size
+    qint64 _start = 0;
+    qint64 _size = 0;
+    // Position in the chunk
     qint64 _read;
 
     // Bandwidth manager related
@@ -226,6 +235,8 @@ protected:
     };
     UploadFileInfo _fileToUpload;
     QByteArray _transmissionChecksumHeader;
+    /// Checksums computed along with the content checksum, by type
+    QMap<QByteArray, QByteArray> _computedChecksums;
 
 public:
     PropagateUploadFileCommon(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
@@ -253,6 +264,10 @@ public:
     void callUnlockFolder();
     bool isLikelyFinishedQuickly() override { return _item->_size < propagator()->smallFileSize(); }
 
+private:
+    /// The type of the transmission checksum to send, empty if none
+    QByteArray transmissionChecksumType() const;
+
 private slots:
     void slotComputeContentChecksum();
     // Content checksum computed, compute the transmission checksum
@@ -307,6 +322,14 @@ protected:
      */
     static void adjustLastJobTimeout(AbstractNetworkJob *job, quint64 fileSize);
 
+    /**
+     * Whether several chunks of a file may be uploaded at the same time.
+     *
+     * Servers can disable it with a capability, OWNCLOUD_PARALLEL_CHUNK
+     * overrides the default.
+     */
+    bool parallelChunkUploadAllowed();
+
     // Bases headers that need to be sent with every chunk
     QMap<QByteArray, QByteArray> headers();
 private:
@@ -371,26 +394,26 @@ class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
     Q_OBJECT
 private:
-    quint64 _sent = 0; /// amount of data (bytes) that was already sent
+    quint64 _sent = 0; /// offset up to which the data was sent or is being sent
     uint _transferId = 0; /// transfer id (part of the url)
-    int _currentChunk = 0; /// Id of the next chunk that will be sent
-    quint64 _currentChunkSize = 0; /// current chunk size
     bool _removeJobError = false; /// If not null, there was an error removing the job
 
-    // Map chunk number with its size  from the PROPFIND on resume.
-    // (Only used from slotPropfindIterate/slotPropfindFinished because the LsColJob use signals to report data.)
+    // Map chunk offset with its size from the PROPFIND on resume.
+    // The chunks that are not reached by _sent yet remain in the map and are skipped later,
+    // since with parallel uploads they may have finished out of order.
     struct ServerChunkInfo
     {
         quint64 size;
         QString originalName;
     };
-    QMap<int, ServerChunkInfo> _serverChunks;
+    QMap<quint64, ServerChunkInfo> _serverChunks;
+    QStringList _staleServerChunks; /// Chunks from the PROPFIND that can't be used
 
     /**
      * Return the URL of a chunk.
-     * If chunk == -1, returns the URL of the parent folder containing the chunks
+     * If offset == -1, returns the URL of the parent folder containing the chunks
      */
-    QUrl chunkUrl(int chunk = -1);
+    QUrl chunkUrl(qint64 offset = -1);
 
 public:
     PropagateUploadFileNG(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
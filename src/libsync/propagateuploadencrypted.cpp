@@ -162,33 +162,38 @@ void PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived(const QJsonDo
 
   qCDebug(lcPropagateUploadEncrypted) << "Creating the encrypted file.";
 
-  QFile input(info.absoluteFilePath());
-  QFile output(QDir::tempPath() + QDir::separator() + encryptedFile.encryptedFilename);
+  _encryptedFile = encryptedFile;
+  _metadataStatusCode = statusCode;
+  _completeFileName = QDir::tempPath() + QDir::separator() + encryptedFile.encryptedFilename;
 
-  QByteArray tag;
-  bool encryptionResult = EncryptionHelper::fileEncryption(
+  // Large files take a while to encrypt, do it in a worker thread
+  auto job = new FileEncryptionJob(FileEncryptionJob::Encrypt,
     encryptedFile.encryptionKey,
     encryptedFile.initializationVector,
-    &input, &output, tag);
+    info.absoluteFilePath(), _completeFileName, this);
+  connect(job, &FileEncryptionJob::finished, this, &PropagateUploadEncrypted::slotFileEncrypted);
+  job->start();
+}
+
+void PropagateUploadEncrypted::slotFileEncrypted(bool success)
+{
+  auto job = qobject_cast<FileEncryptionJob *>(sender());
+  job->deleteLater();
 
-  if (!encryptionResult) {
+  if (!success) {
     qCDebug(lcPropagateUploadEncrypted()) << "There was an error encrypting the file, aborting upload.";
     unlockFolder();
     return;
   }
 
-  _completeFileName = output.fileName();
-
   qCDebug(lcPropagateUploadEncrypted) << "Creating the metadata for the encrypted file.";
 
-  encryptedFile.authenticationTag = tag;
-
-  _metadata->addEncryptedFile(encryptedFile);
-  _encryptedFile = encryptedFile;
+  _encryptedFile.authenticationTag = job->tag();
+  _metadata->addEncryptedFile(_encryptedFile);
 
   qCDebug(lcPropagateUploadEncrypted) << "Metadata created, sending to the server.";
 
-  if (statusCode == 404) {
+  if (_metadataStatusCode == 404) {
     auto job = new StoreMetaDataApiJob(_propagator->account(),
                                        _folderId,
                                        _metadata->encryptedMetadata());
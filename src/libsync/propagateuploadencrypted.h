@@ -50,6 +50,7 @@ private slots:
     void slotFolderLockedError(const QByteArray& fileId, int httpErrorCode);
     void slotTryLock(const QByteArray& fileId);
     void slotFolderEncryptedMetadataReceived(const QJsonDocument &json, int statusCode);
+    void slotFileEncrypted(bool success);
     void slotFolderEncryptedMetadataError(const QByteArray& fileId, int httpReturnCode);
     void slotUpdateMetadataSuccess(const QByteArray& fileId);
     void slotUpdateMetadataError(const QByteArray& fileId, int httpReturnCode);
@@ -74,6 +75,7 @@ private:
   FolderMetadata *_metadata;
   EncryptedFile _encryptedFile;
   QString _completeFileName;
+  int _metadataStatusCode = 0;
 };
 
 
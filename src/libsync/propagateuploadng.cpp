@@ -35,14 +35,18 @@
 
 namespace OCC {
 
-QUrl PropagateUploadFileNG::chunkUrl(int chunk)
+// Chunks are named by their offset in the file, so the chunks that are on
+// the server tell which parts are done even if they finished out of order
+static const int chunkNameLength = 16;
+
+QUrl PropagateUploadFileNG::chunkUrl(qint64 offset)
 {
     QString path = QLatin1String("remote.php/dav/uploads/")
         + propagator()->account()->davUser()
         + QLatin1Char('/') + QString::number(_transferId);
-    if (chunk >= 0) {
+    if (offset >= 0) {
         // We need to do add leading 0 because the server orders the chunk alphabetically
-        path += QLatin1Char('/') + QString::number(chunk).rightJustified(8, '0');
+        path += QLatin1Char('/') + QString::number(offset).rightJustified(chunkNameLength, '0');
     }
     return Utility::concatUrlPath(propagator()->account()->url(), path);
 }
@@ -68,9 +72,9 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
     +-----+<------------------------------------------------------+<---  slotDeleteJobFinished()
     |
     +---->  startNextChunk()  ---finished?  --+
-                  ^               |          |
-                  +---------------+          |
-                                             |
+                  ^     |         |          |
+                  +-----+---------+          |
+       (several chunks in flight)            |
     +----------------------------------------+
     |
     +-> MOVE ------> moveJobFinished() ---> finalize()
@@ -116,10 +120,12 @@ void PropagateUploadFileNG::slotPropfindIterate(const QString &name, const QMap<
     }
     bool ok = false;
     QString chunkName = name.mid(name.lastIndexOf('/') + 1);
-    auto chunkId = chunkName.toUInt(&ok);
-    if (ok) {
+    auto offset = chunkName.toULongLong(&ok);
+    if (ok && chunkName.size() == chunkNameLength) {
         ServerChunkInfo chunkinfo = { properties["getcontentlength"].toULongLong(), chunkName };
-        _serverChunks[chunkId] = chunkinfo;
+        _serverChunks[offset] = chunkinfo;
+    } else {
+        _staleServerChunks.append(chunkName);
     }
 }
 
@@ -129,41 +135,42 @@ void PropagateUploadFileNG::slotPropfindFinished()
     slotJobDestroyed(job); // remove it from the _jobs list
     propagator()->_activeJobList.removeOne(this);
 
-    _currentChunk = 0;
-    _sent = 0;
-    while (_serverChunks.contains(_currentChunk)) {
-        _sent += _serverChunks[_currentChunk].size;
-        _serverChunks.remove(_currentChunk);
-        ++_currentChunk;
+    // Keep the chunks that fit into the file without overlapping each other.
+    // Normally they all do because the size is xor'ed with the transfer id, and it
+    // is therefore impossible that there is more data on the server than on the file.
+    QStringList staleChunks = _staleServerChunks;
+    _staleServerChunks.clear();
+    quint64 end = 0;
+    for (auto it = _serverChunks.begin(); it != _serverChunks.end();) {
+        if (it.key() < end || it->size == 0 || it.key() + it->size > _fileToUpload._size) {
+            staleChunks.append(it->originalName);
+            it = _serverChunks.erase(it);
+        } else {
+            end = it.key() + it->size;
+            ++it;
+        }
     }
 
-    if (_sent > _fileToUpload._size) {
-        // Normally this can't happen because the size is xor'ed with the transfer id, and it is
-        // therefore impossible that there is more data on the server than on the file.
-        qCCritical(lcPropagateUpload) << "Inconsistency while resuming " << _item->_file
-                                      << ": the size on the server (" << _sent << ") is bigger than the size of the file ("
-                                      << _fileToUpload._size << ")";
-        startNewUpload();
-        return;
-    }
+    _sent = 0;
+    while (_serverChunks.contains(_sent))
+        _sent += _serverChunks.take(_sent).size;
 
-    qCInfo(lcPropagateUpload) << "Resuming " << _item->_file << " from chunk " << _currentChunk << "; sent =" << _sent;
+    qCInfo(lcPropagateUpload) << "Resuming " << _item->_file << " from offset " << _sent
+                              << "; more chunks done:" << _serverChunks.size();
 
-    if (!_serverChunks.isEmpty()) {
-        qCInfo(lcPropagateUpload) << "To Delete" << _serverChunks.keys();
+    if (!staleChunks.isEmpty()) {
+        qCInfo(lcPropagateUpload) << "To Delete" << staleChunks;
         propagator()->_activeJobList.append(this);
         _removeJobError = false;
 
-        // Make sure that if there is a "hole" and then a few more chunks, on the server
-        // we should remove the later chunks. Otherwise when we do dynamic chunk sizing, we may end up
-        // with corruptions if there are too many chunks, or if we abort and there are still stale chunks.
-        for (auto it = _serverChunks.begin(); it != _serverChunks.end(); ++it) {
-            auto job = new DeleteJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), it->originalName), this);
+        // Otherwise the server would assemble them into the file, or we
+        // would get corruptions if we abort and there are still stale chunks.
+        foreach (const QString &chunkName, staleChunks) {
+            auto job = new DeleteJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), chunkName), this);
             QObject::connect(job, &DeleteJob::finishedSignal, this, &PropagateUploadFileNG::slotDeleteJobFinished);
             _jobs.append(job);
             job->start();
         }
-        _serverChunks.clear();
         return;
     }
 
@@ -209,6 +216,7 @@ void PropagateUploadFileNG::slotDeleteJobFinished()
         propagator()->_activeJobList.removeOne(this);
         if (_removeJobError) {
             // There was an error removing some files, just start over
+            _serverChunks.clear();
             startNewUpload();
         } else {
             startNextChunk();
@@ -222,7 +230,7 @@ void PropagateUploadFileNG::startNewUpload()
     ASSERT(propagator()->_activeJobList.count(this) == 1);
     _transferId = qrand() ^ _item->_modtime ^ (_fileToUpload._size << 16) ^ qHash(_fileToUpload._file);
     _sent = 0;
-    _currentChunk = 0;
+    _serverChunks.clear();
 
     propagator()->reportProgress(*_item, 0);
 
@@ -270,11 +278,15 @@ void PropagateUploadFileNG::startNextChunk()
     quint64 fileSize = _fileToUpload._size;
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
-    // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    // Skip the chunks that were already uploaded before we resumed
+    while (_serverChunks.contains(_sent))
+        _sent += _serverChunks.take(_sent).size;
 
-    if (_currentChunkSize == 0) {
-        Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
+    if (_sent == fileSize) {
+        if (!_jobs.isEmpty()) {
+            // Chunks are still running, the last one to finish does the MOVE
+            return;
+        }
         _finished = true;
 
         // Finish with a MOVE
@@ -305,10 +317,16 @@ void PropagateUploadFileNG::startNextChunk()
         return;
     }
 
+    // prevent situation that chunk size is bigger then required one to send,
+    // and don't overlap a chunk that is already on the server
+    quint64 currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    if (!_serverChunks.isEmpty())
+        currentChunkSize = qMin(currentChunkSize, _serverChunks.firstKey() - _sent);
+
     auto device = std::make_unique<UploadDevice>(&propagator()->_bandwidthManager);
     const QString fileName = _fileToUpload._path;
 
-    if (!device->prepareAndOpen(fileName, _sent, _currentChunkSize)) {
+    if (!device->prepareAndOpen(fileName, _sent, currentChunkSize)) {
         qCWarning(lcPropagateUpload) << "Could not prepare upload device: " << device->errorString();
 
         // If the file is currently locked, we want to retry the sync
@@ -324,12 +342,13 @@ void PropagateUploadFileNG::startNextChunk()
     QMap<QByteArray, QByteArray> headers;
     headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
 
-    _sent += _currentChunkSize;
-    QUrl url = chunkUrl(_currentChunk);
+    QUrl url = chunkUrl(_sent);
+    _sent += currentChunkSize;
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
+    // (the chunk number is only used by the old chunking)
     auto devicePtr = device.get(); // for connections later
-    PUTFileJob *job = new PUTFileJob(propagator()->account(), url, std::move(device), headers, _currentChunk, this);
+    PUTFileJob *job = new PUTFileJob(propagator()->account(), url, std::move(device), headers, 0, this);
     _jobs.append(job);
     connect(job, &PUTFileJob::finishedSignal, this, &PropagateUploadFileNG::slotPutFinished);
     connect(job, &PUTFileJob::uploadProgress,
@@ -339,7 +358,13 @@ void PropagateUploadFileNG::startNextChunk()
     connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
     job->start();
     propagator()->_activeJobList.append(this);
-    _currentChunk++;
+
+    // Keep several chunks in flight as long as the propagator has room for more transfers.
+    // A single chunk can only use one window per round trip.
+    if (_sent < fileSize && parallelChunkUploadAllowed()
+        && propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob()) {
+        startNextChunk();
+    }
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -373,7 +398,8 @@ void PropagateUploadFileNG::slotPutFinished()
     auto targetDuration = propagator()->syncOptions()._targetChunkUploadDuration;
     if (targetDuration.count() > 0) {
         auto uploadTime = ++job->msSinceStart(); // add one to avoid div-by-zero
-        qint64 predictedGoodSize = (_currentChunkSize * targetDuration) / uploadTime;
+        quint64 chunkSize = job->device()->size();
+        qint64 predictedGoodSize = (chunkSize * targetDuration) / uploadTime;
 
         // The whole targeting is heuristic. The predictedGoodSize will fluctuate
         // quite a bit because of external factors (like available bandwidth)
@@ -389,18 +415,19 @@ void PropagateUploadFileNG::slotPutFinished()
             targetSize,
             propagator()->syncOptions()._maxChunkSize);
 
-        qCInfo(lcPropagateUpload) << "Chunked upload of" << _currentChunkSize << "bytes took" << uploadTime.count()
+        qCInfo(lcPropagateUpload) << "Chunked upload of" << chunkSize << "bytes took" << uploadTime.count()
                                   << "ms, desired is" << targetDuration.count() << "ms, expected good chunk size is"
                                   << predictedGoodSize << "bytes and nudged next chunk size to "
                                   << propagator()->_chunkSize << "bytes";
     }
 
-    _finished = _sent == _item->_size;
+    // Other chunks may still be running
+    bool lastChunk = _sent == _item->_size && _jobs.isEmpty();
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->getFilePath(_item->_file));
     if (!FileSystem::fileExists(fullFilePath)) {
-        if (!_finished) {
+        if (!lastChunk) {
             abortWithError(SyncFileItem::SoftError, tr("The local file was removed during sync."));
             return;
         } else {
@@ -411,13 +438,13 @@ void PropagateUploadFileNG::slotPutFinished()
     // Check whether the file changed since discovery - this acts on the original file.
     if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
         propagator()->_anotherSyncNeeded = true;
-        if (!_finished) {
+        if (!lastChunk) {
             abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
             return;
         }
     }
 
-    if (!_finished) {
+    if (!lastChunk) {
         // Deletes an existing blacklist entry on successful chunk upload
         if (_item->_hasBlacklistEntry) {
             propagator()->_journal->wipeErrorBlacklistEntry(_item->_file);
@@ -483,7 +510,15 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+
+    // _sent includes the whole of the running chunks, take away what they still need to send
+    sender()->setProperty("byteWritten", sent);
+    qint64 amount = _sent;
+    foreach (AbstractNetworkJob *job, _jobs) {
+        if (auto putJob = qobject_cast<PUTFileJob *>(job))
+            amount -= putJob->device()->size() - putJob->property("byteWritten").toLongLong();
+    }
+    propagator()->reportProgress(*_item, amount);
 }
 
 void PropagateUploadFileNG::abort(PropagatorJob::AbortType abortType)
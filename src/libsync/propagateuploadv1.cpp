@@ -151,24 +151,7 @@ void PropagateUploadFileV1::startNextChunk()
     propagator()->_activeJobList.append(this);
     _currentChunk++;
 
-    bool parallelChunkUpload = true;
-
-    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
-        // Server may also disable parallel chunked upload for any higher version
-        parallelChunkUpload = false;
-    } else {
-        QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
-        if (!env.isEmpty()) {
-            parallelChunkUpload = env != "false" && env != "0";
-        } else {
-            int versionNum = propagator()->account()->serverVersionInt();
-            if (versionNum < Account::makeServerVersion(8, 0, 3)) {
-                // Disable parallel chunk upload severs older than 8.0.3 to avoid too many
-                // internal sever errors (#2743, #2938)
-                parallelChunkUpload = false;
-            }
-        }
-    }
+    bool parallelChunkUpload = parallelChunkUploadAllowed();
 
     if (_currentChunk + _startChunk >= _chunkCount - 1) {
         // Don't do parallel upload of chunk if this might be the last chunk because the server cannot handle that
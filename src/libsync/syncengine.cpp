@@ -58,7 +58,6 @@ namespace OCC {
 Q_LOGGING_CATEGORY(lcEngine, "nextcloud.sync.engine", QtInfoMsg)
 
 static const int s_touchedFilesMaxAgeMs = 15 * 1000;
-bool SyncEngine::s_anySyncRunning = false;
 
 qint64 SyncEngine::minimumFileAgeForUpload = 2000;
 
@@ -93,6 +92,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
 
     _excludedFiles.reset(new ExcludedFiles(localPath));
     _csync_ctx->exclude_traversal_fn = _excludedFiles->csyncTraversalMatchFun();
+    _csync_ctx->exclude_in_tree_file_fn = _excludedFiles->csyncInTreeExcludeFileFun();
 
     _syncFileStatusTracker.reset(new SyncFileStatusTracker(this));
 
@@ -769,12 +769,11 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false);
         return;
     }
 
-    s_anySyncRunning = true;
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
@@ -885,6 +884,11 @@ void SyncEngine::startSync()
 
     _discoveryMainThread = new DiscoveryMainThread(account());
     _discoveryMainThread->setParent(this);
+    _discoveryMainThread->setMaximumActiveJobs(OwncloudPropagator::hardMaximumActiveJob(account(), _syncOptions));
+    if (_syncOptions._bulkInitialDiscovery && _journal->getFileRecordCount() == 0) {
+        qCInfo(lcEngine) << "Initial sync, listing the whole remote tree at once";
+        _discoveryMainThread->setBulkDiscovery(true);
+    }
     connect(this, &SyncEngine::finished, _discoveryMainThread.data(), &QObject::deleteLater);
     qCInfo(lcEngine) << "Server" << account()->serverVersion()
                      << (account()->isHttp2Supported() ? "Using HTTP/2" : "");
@@ -907,6 +911,8 @@ void SyncEngine::startSync()
     }
 
     discoveryJob->_syncOptions = _syncOptions;
+    // Syncs driven by the file watcher only look up the few paths that changed
+    discoveryJob->_loadMetadataSnapshot = _localDiscoveryStyle == LocalDiscoveryStyle::FilesystemOnly;
     discoveryJob->moveToThread(&_thread);
     connect(discoveryJob, &DiscoveryJob::finished, this, &SyncEngine::slotDiscoveryJobFinished);
     connect(discoveryJob, &DiscoveryJob::folderDiscovered,
@@ -1123,6 +1129,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // Re-init the csync context to free memory
     _csync_ctx->reinitialize();
     _localDiscoveryPaths.clear();
+    _localDiscoverySubtrees.clear();
 
     // To announce the beginning of the sync
     emit aboutToPropagate(syncItems);
@@ -1254,7 +1261,6 @@ void SyncEngine::finalize(bool success)
     qCInfo(lcEngine) << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished")) << "ms";
     _stopWatch.stop();
 
-    s_anySyncRunning = false;
     _syncRunning = false;
     emit finished(success);
 
@@ -1265,6 +1271,7 @@ void SyncEngine::finalize(bool success)
     _renamedFolders.clear();
     _uniqueErrors.clear();
     _localDiscoveryPaths.clear();
+    _localDiscoverySubtrees.clear();
     _localDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
 
     _clearTouchedFilesTimer.start();
@@ -1670,10 +1677,19 @@ AccountPtr SyncEngine::account() const
     return _account;
 }
 
-void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> paths)
+void SyncEngine::setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> paths,
+    std::set<QByteArray> subtrees)
 {
+    if (subtrees.count(QByteArray())) {
+        // The whole tree needs to be scanned
+        style = LocalDiscoveryStyle::FilesystemOnly;
+        paths.clear();
+        subtrees.clear();
+    }
     _localDiscoveryStyle = style;
     _localDiscoveryPaths = std::move(paths);
+    _localDiscoveryPaths.insert(subtrees.begin(), subtrees.end());
+    _localDiscoverySubtrees = std::move(subtrees);
 }
 
 bool SyncEngine::shouldDiscoverLocally(const QByteArray &path) const
@@ -1681,6 +1697,16 @@ bool SyncEngine::shouldDiscoverLocally(const QByteArray &path) const
     if (_localDiscoveryStyle == LocalDiscoveryStyle::FilesystemOnly)
         return true;
 
+    // within one of the subtrees?
+    if (!_localDiscoverySubtrees.empty()) {
+        for (int i = path.indexOf('/'); i != -1; i = path.indexOf('/', i + 1)) {
+            if (_localDiscoverySubtrees.count(path.left(i)))
+                return true;
+        }
+        if (_localDiscoverySubtrees.count(path))
+            return true;
+    }
+
     auto it = _localDiscoveryPaths.lower_bound(path);
     if (it == _localDiscoveryPaths.end() || !it->startsWith(path))
         return false;
@@ -107,11 +107,17 @@ public:
      * the synced folder. All the parent directories of these paths will not
      * be read from the db and scanned on the filesystem.
      *
+     * subtrees are folders that are scanned on the filesystem completely,
+     * including all their subfolders. That's used for folders the file
+     * watcher can't observe. An empty subtree stands for the whole folder and
+     * turns the style into FilesystemOnly.
+     *
      * Note, the style and paths are only retained for the next sync and
      * revert afterwards. Use _lastLocalDiscoveryStyle to discover the last
      * sync's style.
      */
-    void setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> paths = {});
+    void setLocalDiscoveryOptions(LocalDiscoveryStyle style, std::set<QByteArray> paths = {},
+        std::set<QByteArray> subtrees = {});
 
     /**
      * Returns whether the given folder-relative path should be locally discovered
@@ -222,8 +228,6 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
-
     // Must only be acessed during update and reconcile
     QMap<QString, SyncFileItemPtr> _syncItemMap;
 
@@ -311,6 +315,7 @@ private:
     LocalDiscoveryStyle _lastLocalDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
     LocalDiscoveryStyle _localDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
     std::set<QByteArray> _localDiscoveryPaths;
+    std::set<QByteArray> _localDiscoverySubtrees;
 };
 }
 
@@ -59,6 +59,13 @@ struct SyncOptions
 
     /** Whether parallel network jobs are allowed. */
     bool _parallelNetworkJobs = true;
+
+    /** Whether the first sync lists the whole remote tree with a single
+     * Depth: infinity PROPFIND instead of one request per directory.
+     *
+     * Falls back to listing each directory if the server refuses.
+     */
+    bool _bulkInitialDiscovery = false;
 };
 
 
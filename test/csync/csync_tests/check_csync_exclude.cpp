@@ -291,6 +291,43 @@ static void check_csync_excluded_per_dir(void **)
 #undef FOO_EXCLUDE_LIST
 }
 
+static void check_csync_in_tree_exclude_file(void **)
+{
+#define FOO_DIR "/tmp/check_csync1/foo"
+#define FOO_EXCLUDE_LIST FOO_DIR "/.sync-exclude.lst"
+    int rc;
+    rc = system("mkdir -p " FOO_DIR);
+    assert_int_equal(rc, 0);
+    FILE *fh = fopen(FOO_EXCLUDE_LIST, "w");
+    assert_non_null(fh);
+    rc = fprintf(fh, "bar");
+    assert_int_not_equal(rc, 0);
+    rc = fclose(fh);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(check_file_traversal("tmp/check_csync1/foo/bar"), CSYNC_NOT_EXCLUDED);
+
+    excludedFiles->loadInTreeExcludeFile("tmp/check_csync1/foo");
+    assert_int_equal(check_file_traversal("tmp/check_csync1/foo/bar"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_file_traversal("tmp/check_csync1/foo/baz"), CSYNC_NOT_EXCLUDED);
+
+    // Seeing the file again doesn't add its patterns a second time
+    excludedFiles->loadInTreeExcludeFile("tmp/check_csync1/foo");
+    assert_int_equal(excludedFiles->_allExcludes.value(FOO_DIR "/").size(), 1);
+    assert_true(excludedFiles->reloadExcludeFiles());
+    assert_int_equal(excludedFiles->_allExcludes.value(FOO_DIR "/").size(), 1);
+    assert_int_equal(check_file_traversal("tmp/check_csync1/foo/bar"), CSYNC_FILE_EXCLUDE_LIST);
+
+    // Once removed, it is forgotten on the next reload
+    rc = system("rm " FOO_EXCLUDE_LIST);
+    assert_int_equal(rc, 0);
+    assert_true(excludedFiles->reloadExcludeFiles());
+    assert_true(excludedFiles->_inTreeExcludeFiles.isEmpty());
+    assert_int_equal(check_file_traversal("tmp/check_csync1/foo/bar"), CSYNC_NOT_EXCLUDED);
+#undef FOO_DIR
+#undef FOO_EXCLUDE_LIST
+}
+
 static void check_csync_excluded_traversal_per_dir(void **)
 {
     assert_int_equal(check_file_traversal("/"), CSYNC_NOT_EXCLUDED);
@@ -597,6 +634,46 @@ static void check_csync_bname_trigger(void **)
     assert_string_equal(translate("a/abc*/foo*"), "foo*");
 }
 
+static void check_csync_bname_matcher(void **)
+{
+    // The byte based matcher must agree with the regex wherever it decides
+    const char *names[] = {
+        "", "a", "foo~", "~$foo", ".~lock.x#", "~x.tmp", "a.~b", "Thumbs.db", "thumbs.db",
+        ".DS_Store", "._x", "System Volume Information", ".x.swp", ".x.y.swo", ".x.sw",
+        "file.part", "file.partial", "x.gnucash.tmp-1", ".nfs123", "#x#", "#x", "My Saved Places.",
+        "Icon\r", "Icon\rx", "line\nbreak~", "x.💩", "x.💩x", "пятницы.txt", "ПЯТНИЦЫ.txt", "\xff~", "run.xml",
+        "x.out", "A", ".fuse_hidden0001", "foo.unison", "x~y"
+    };
+
+    assert_true(excludedFiles->_bnameMatchers.contains("/"));
+    const auto &matcher = excludedFiles->_bnameMatchers["/"];
+    for (auto filetype : { ItemTypeFile, ItemTypeDirectory }) {
+        const auto &regex = filetype == ItemTypeFile
+            ? excludedFiles->_bnameTraversalRegexFile["/"]
+            : excludedFiles->_bnameTraversalRegexDir["/"];
+        for (const char *name : names) {
+            ExcludedFiles::BnameMatcher::Result result;
+            if (!matcher.match(name, strlen(name), filetype, &result))
+                continue;
+            auto m = regex.match(QString::fromUtf8(name));
+            auto expected = ExcludedFiles::BnameMatcher::Trigger;
+            if (!m.hasMatch())
+                expected = ExcludedFiles::BnameMatcher::NoMatch;
+            else if (m.capturedStart(QStringLiteral("exclude")) != -1)
+                expected = ExcludedFiles::BnameMatcher::Exclude;
+            else if (m.capturedStart(QStringLiteral("excluderemove")) != -1)
+                expected = ExcludedFiles::BnameMatcher::ExcludeAndRemove;
+            if (result != expected)
+                print_error("bname matcher differs for '%s'\n", name);
+            assert_int_equal(result, expected);
+        }
+    }
+
+    // Names with line breaks are left to the regex
+    ExcludedFiles::BnameMatcher::Result result;
+    assert_false(matcher.match("Icon\r", 5, ItemTypeFile, &result));
+}
+
 static void check_csync_is_windows_reserved_word(void **)
 {
     assert_true(csync_is_windows_reserved_word("CON"));
@@ -707,11 +784,13 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(T::check_csync_excluded_per_dir, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_excluded_traversal, T::setup_init, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_excluded_traversal_per_dir, T::setup, T::teardown),
+        cmocka_unit_test_setup_teardown(T::check_csync_in_tree_exclude_file, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_dir_only, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_pathes, T::setup_init, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_wildcards, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_regex_translation, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_bname_trigger, T::setup, T::teardown),
+        cmocka_unit_test_setup_teardown(T::check_csync_bname_matcher, T::setup_init, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_is_windows_reserved_word, T::setup_init, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_excluded_performance, T::setup_init, T::teardown),
         cmocka_unit_test(T::check_csync_exclude_expand_escapes),
@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 #include "common/utility.h"
+#include "csync_private.h"
 #include <stdlib.h>
 #include "torture.h"
 
@@ -44,10 +45,43 @@ static void check_csync_normalize_etag(void **state)
   CHECK_NORMALIZE_ETAG("\"foo-gzip\"", "foo");
 }
 
+static std::unique_ptr<csync_file_stat_t> make_stat(const char *path, const char *mangledName)
+{
+    std::unique_ptr<csync_file_stat_t> st(new csync_file_stat_t);
+    st->path = path;
+    st->e2eMangledName = mangledName;
+    return st;
+}
+
+static void check_csync_filemap_mangled_name(void **state)
+{
+    csync_s::FileMap files;
+
+    (void) state; /* unused */
+
+    files.insertFile(QByteArray("plain"), make_stat("plain", ""));
+    files.insertFile(QByteArray("enc/a"), make_stat("enc/a", "enc/0123"));
+    files.insertFile(QByteArray("enc/b"), make_stat("enc/b", "enc/4567"));
+
+    assert_ptr_equal(files.findFileMangledName(QByteArray("enc/0123")), files.findFile(QByteArray("enc/a")));
+    assert_ptr_equal(files.findFileMangledName(QByteArray("enc/4567")), files.findFile(QByteArray("enc/b")));
+    assert_null(files.findFileMangledName(QByteArray("plain")));
+    assert_null(files.findFileMangledName(QByteArray("")));
+
+    /* Replacing an entry drops its old mangled name from the index */
+    files.insertFile(QByteArray("enc/a"), make_stat("enc/a", "enc/89ab"));
+    assert_null(files.findFileMangledName(QByteArray("enc/0123")));
+    assert_ptr_equal(files.findFileMangledName(QByteArray("enc/89ab")), files.findFile(QByteArray("enc/a")));
+
+    files.clear();
+    assert_null(files.findFileMangledName(QByteArray("enc/4567")));
+}
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(check_csync_normalize_etag),
+        cmocka_unit_test(check_csync_filemap_mangled_name),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -372,9 +372,16 @@ public:
             xml.writeEndElement(); // response
         };
 
+        const bool infiniteDepth = request.rawHeader("Depth") == "infinity";
+        std::function<void(const FileInfo &)> writeChildrenResponses = [&](const FileInfo &parentInfo) {
+            foreach (const FileInfo &childFileInfo, parentInfo.children) {
+                writeFileResponse(childFileInfo);
+                if (infiniteDepth)
+                    writeChildrenResponses(childFileInfo);
+            }
+        };
         writeFileResponse(*fileInfo);
-        foreach(const FileInfo &childFileInfo, fileInfo->children)
-           writeFileResponse(childFileInfo);
+        writeChildrenResponses(*fileInfo);
         xml.writeEndElement(); // multistatus
         xml.writeEndDocument();
 
@@ -558,6 +565,7 @@ public:
     char payload;
     int size;
     bool aborted = false;
+    bool honorRange = false; // by default the Range header is ignored
 
     FakeGetReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
     : QNetworkReply{parent} {
@@ -572,7 +580,7 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
-    Q_INVOKABLE void respond() {
+    Q_INVOKABLE virtual void respond() {
         if (aborted) {
             setError(OperationCanceledError, "Operation Canceled");
             emit metaDataChanged();
@@ -581,8 +589,18 @@ public:
         }
         payload = fileInfo->contentChar;
         size = fileInfo->size;
+        QRegExp rangeRx("bytes=(\\d+)-(\\d*)");
+        if (honorRange && rangeRx.exactMatch(request().rawHeader("Range"))) {
+            const qint64 start = rangeRx.cap(1).toLongLong();
+            const qint64 end = rangeRx.cap(2).isEmpty() ? size : qMin<qint64>(size, rangeRx.cap(2).toLongLong() + 1);
+            setRawHeader("Content-Range", "bytes " + QByteArray::number(start) + '-' + QByteArray::number(end - 1)
+                    + '/' + QByteArray::number(size));
+            size = end - start;
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+        } else {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        }
         setHeader(QNetworkRequest::ContentLengthHeader, size);
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
         setRawHeader("OC-FileId", fileInfo->fileId);
@@ -639,21 +657,20 @@ public:
         int size = 0;
         char payload = '\0';
 
-        do {
-            QString chunkName = QString::number(count).rightJustified(8, '0');
-            if (!sourceFolder->children.contains(chunkName))
-                break;
-            auto &x = sourceFolder->children[chunkName];
+        // The chunks are named by their offset, and assembled in the order of their names
+        for (auto it = sourceFolder->children.cbegin(); it != sourceFolder->children.cend(); ++it) {
+            auto &x = *it;
             Q_ASSERT(!x.isDir);
             Q_ASSERT(x.size > 0); // There should not be empty chunks
+            Q_ASSERT(it.key().size() == 16);
+            QCOMPARE(it.key().toLongLong(), qint64(size)); // There should not be holes or extra files
             size += x.size;
             Q_ASSERT(!payload || payload == x.contentChar);
             payload = x.contentChar;
             ++count;
-        } while(true);
+        }
 
         Q_ASSERT(count > 1); // There should be at least two chunks, otherwise why would we use chunking?
-        QCOMPARE(sourceFolder->children.count(), count); // There should not be holes or extra files
 
         QString fileName = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
         Q_ASSERT(!fileName.isEmpty());
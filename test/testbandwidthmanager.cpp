@@ -0,0 +1,196 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "account.h"
+#include "bandwidthmanager.h"
+#include "owncloudpropagator.h"
+#include "propagateupload.h"
+
+#include <memory>
+
+using namespace OCC;
+
+class TestBandwidthManager : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    AccountPtr _account = Account::create();
+
+    // The timers of the managers never fire: the tests don't run an event
+    // loop and call the slots themselves.
+    std::unique_ptr<OwncloudPropagator> makePropagator(int uploadLimit)
+    {
+        std::unique_ptr<OwncloudPropagator> propagator(new OwncloudPropagator(_account, _dir.path(), "/", nullptr));
+        propagator->_uploadLimit.fetchAndStoreOrdered(uploadLimit);
+        propagator->_bandwidthManager.switchingTimerExpired();
+        return propagator;
+    }
+
+    std::unique_ptr<UploadDevice> makeDevice(OwncloudPropagator &propagator)
+    {
+        std::unique_ptr<UploadDevice> device(new UploadDevice(&propagator._bandwidthManager));
+        device->prepareAndOpen(_dir.path() + "/data", 0, 10 * 1000 * 1000);
+        return device;
+    }
+
+    // Reads as much as the device may send, like QNAM does
+    static qint64 consume(UploadDevice &device)
+    {
+        QByteArray buffer(device.bandwidthQuota() + 1, Qt::Uninitialized);
+        const qint64 read = device.read(buffer.data(), buffer.size());
+        return qMax<qint64>(0, read);
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+        QFile file(_dir.path() + "/data");
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(QByteArray(10 * 1000 * 1000, 'x'));
+    }
+
+    void testPacing()
+    {
+        auto propagator = makePropagator(100000);
+        auto &manager = propagator->_bandwidthManager;
+        auto device1 = makeDevice(*propagator);
+        auto device2 = makeDevice(*propagator);
+
+        // Each 100 ms step hands out a tenth of the rate
+        qint64 sent = 0;
+        for (int i = 0; i < 10; ++i) {
+            manager.absoluteLimitTimerExpired();
+            QCOMPARE(device1->bandwidthQuota() + device2->bandwidthQuota(), qint64(10000));
+            sent += consume(*device1) + consume(*device2);
+        }
+        QCOMPARE(sent, qint64(100000));
+
+        // Idle transfers don't save up more than 250 ms worth of the rate
+        for (int i = 0; i < 10; ++i)
+            manager.absoluteLimitTimerExpired();
+        QCOMPARE(device1->bandwidthQuota() + device2->bandwidthQuota(), qint64(25000));
+    }
+
+    void testRelativePacing()
+    {
+        auto propagator = makePropagator(-50);
+        auto &manager = propagator->_bandwidthManager;
+        auto device1 = makeDevice(*propagator);
+        auto device2 = makeDevice(*propagator);
+        QVERIFY(device1->isChoked());
+        QVERIFY(device2->isChoked());
+
+        // While measuring, one device sends at full speed and nothing is paced
+        manager.relativeUploadDelayTimerExpired();
+        QVERIFY(!device1->isBandwidthLimited());
+        QVERIFY(!device1->isChoked());
+        QVERIFY(device2->isChoked());
+        manager.absoluteLimitTimerExpired();
+        QCOMPARE(device2->bandwidthQuota(), qint64(0));
+
+        // 100000 bytes per second during the 2 s window. Half of what it sent
+        // is paced out over the 6 s until the next measurement.
+        device1->slotJobUploadProgress(200000, 10 * 1000 * 1000);
+        manager.relativeUploadMeasuringTimerExpired();
+        QVERIFY(device1->isBandwidthLimited());
+        QVERIFY(!device1->isChoked());
+        QVERIFY(!device2->isChoked());
+        qint64 sent = 0;
+        for (int i = 0; i < 60; ++i) {
+            manager.absoluteLimitTimerExpired();
+            QCOMPARE(device1->bandwidthQuota(), qint64(833));
+            QCOMPARE(device2->bandwidthQuota(), qint64(833));
+            sent += consume(*device1) + consume(*device2);
+        }
+        QVERIFY(qAbs(sent - 100000) <= 100);
+
+        // The next measurement takes the other device and is smoothed with
+        // the previous one: 150000 bytes per second
+        manager.relativeUploadDelayTimerExpired();
+        QVERIFY(!device2->isBandwidthLimited());
+        QVERIFY(device1->isChoked());
+        device2->slotJobUploadProgress(400000, 10 * 1000 * 1000);
+        manager.relativeUploadMeasuringTimerExpired();
+        manager.absoluteLimitTimerExpired();
+        QCOMPARE(device1->bandwidthQuota(), qint64(1250));
+        QCOMPARE(device2->bandwidthQuota(), qint64(1250));
+    }
+
+    void testFairSplit()
+    {
+        auto propagator = makePropagator(100000);
+        auto &manager = propagator->_bandwidthManager;
+        auto device1 = makeDevice(*propagator);
+        auto device2 = makeDevice(*propagator);
+        QVERIFY(device1->isBandwidthLimited());
+        QVERIFY(!device1->isChoked());
+
+        manager.absoluteLimitTimerExpired();
+        QCOMPARE(device1->bandwidthQuota(), qint64(5000));
+        QCOMPARE(device2->bandwidthQuota(), qint64(5000));
+
+        // The quota limits what the device sends
+        QCOMPARE(consume(*device1), qint64(5000));
+        QCOMPARE(device1->bandwidthQuota(), qint64(0));
+
+        // The quota device2 didn't use goes back into the bucket and is
+        // split between both, so device1 may send faster while device2 waits
+        manager.absoluteLimitTimerExpired();
+        QCOMPARE(device1->bandwidthQuota(), qint64(7500));
+        QCOMPARE(device2->bandwidthQuota(), qint64(7500));
+
+        // A finished transfer doesn't hold on to its share
+        QCOMPARE(consume(*device1), qint64(7500));
+        QCOMPARE(consume(*device2), qint64(7500));
+        device2.reset();
+        manager.absoluteLimitTimerExpired();
+        QCOMPARE(device1->bandwidthQuota(), qint64(10000));
+    }
+
+    void testSharedBetweenManagers()
+    {
+        // Concurrent syncs share the limit in proportion to their transfers
+        auto propagatorA = makePropagator(90000);
+        auto propagatorB = makePropagator(90000);
+        auto deviceA = makeDevice(*propagatorA);
+        auto deviceB1 = makeDevice(*propagatorB);
+        auto deviceB2 = makeDevice(*propagatorB);
+
+        propagatorA->_bandwidthManager.absoluteLimitTimerExpired();
+        propagatorB->_bandwidthManager.absoluteLimitTimerExpired();
+        QCOMPARE(deviceA->bandwidthQuota(), qint64(3000));
+        QCOMPARE(deviceB1->bandwidthQuota(), qint64(3000));
+        QCOMPARE(deviceB2->bandwidthQuota(), qint64(3000));
+
+        // Once the other sync is done, the whole limit is available again
+        consume(*deviceB1);
+        consume(*deviceB2);
+        deviceA.reset();
+        propagatorA.reset();
+        propagatorB->_bandwidthManager.absoluteLimitTimerExpired();
+        QCOMPARE(deviceB1->bandwidthQuota(), qint64(4500));
+        QCOMPARE(deviceB2->bandwidthQuota(), qint64(4500));
+
+        // A sync without a limit doesn't take a share
+        auto propagatorC = makePropagator(0);
+        auto deviceC = makeDevice(*propagatorC);
+        QVERIFY(!deviceC->isBandwidthLimited());
+        consume(*deviceB1);
+        consume(*deviceB2);
+        propagatorB->_bandwidthManager.absoluteLimitTimerExpired();
+        QCOMPARE(deviceB1->bandwidthQuota(), qint64(4500));
+        QCOMPARE(deviceB2->bandwidthQuota(), qint64(4500));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBandwidthManager)
+#include "testbandwidthmanager.moc"
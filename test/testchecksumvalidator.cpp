@@ -116,6 +116,34 @@ using namespace OCC;
         delete vali;
     }
 
+    void testUploadChecksummingMultiple() {
+
+        ComputeChecksum *vali = new ComputeChecksum(this);
+        _expectedType = OCC::checkSumSHA1C;
+        vali->setChecksumType(_expectedType);
+        vali->setAdditionalChecksumTypes({ OCC::checkSumMD5C, "Klaas32" });
+        connect(vali, SIGNAL(done(QByteArray,QByteArray)), this, SLOT(slotUpValidated(QByteArray,QByteArray)));
+
+        QMap<QByteArray, QByteArray> checksums;
+        connect(vali, &ComputeChecksum::checksumsComputed, this,
+            [&](const QMap<QByteArray, QByteArray> &computed) { checksums = computed; });
+
+        _expected = FileSystem::calcSha1( _testfile );
+
+        vali->start(_testfile);
+
+        QEventLoop loop;
+        connect(vali, SIGNAL(done(QByteArray,QByteArray)), &loop, SLOT(quit()), Qt::QueuedConnection);
+        loop.exec();
+
+        // The unknown type is left out
+        QCOMPARE(checksums.size(), 2);
+        QCOMPARE(checksums.value(OCC::checkSumSHA1C), _expected);
+        QCOMPARE(checksums.value(OCC::checkSumMD5C), FileSystem::calcMd5( _testfile ));
+
+        delete vali;
+    }
+
     void testDownloadChecksummingAdler() {
 #ifndef ZLIB_FOUND
         QSKIP("ZLIB not found.", SkipSingle);
@@ -147,6 +175,101 @@ using namespace OCC;
     }
 
 
+    void testKnownChecksums() {
+        const QString file = _root + "/fox";
+        QFile f(file);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write("The quick brown fox jumps over the lazy dog");
+        f.close();
+
+        QCOMPARE(FileSystem::calcSha1(file), QByteArray("2fd4e1c67a2d28fced849ee1bb76e7391b93eb12"));
+        QCOMPARE(FileSystem::calcMd5(file), QByteArray("9e107d9d372bb6826bd81d3542a419d6"));
+#ifdef ZLIB_FOUND
+        QCOMPARE(FileSystem::calcAdler32(file), QByteArray("5bdc0fda"));
+#endif
+        QCOMPARE(FileSystem::calcSha1(_root + "/doesnotexist"), QByteArray());
+    }
+
+    void testIncrementalChecksums() {
+        QFile f(_testfile);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        const QByteArray data = f.readAll();
+
+        QList<QByteArray> types = { checkSumMD5C, checkSumSHA1C };
+#ifdef ZLIB_FOUND
+        types.append(checkSumAdlerC);
+#endif
+        for (const auto &type : types) {
+            ChecksumCalculator calculator(type);
+            QVERIFY(calculator.isValid());
+            // Feed uneven pieces like a network reply would
+            for (int pos = 0; pos < data.size(); pos += 1000)
+                calculator.addData(data.constData() + pos, qMin(1000, data.size() - pos));
+            QCOMPARE(calculator.result(), ComputeChecksum::computeNow(_testfile, type));
+        }
+
+        QVERIFY(!ChecksumCalculator("Klaas32").isValid());
+    }
+
+    void testDownloadValidationWithKnownChecksum() {
+        ValidateChecksumHeader vali;
+        connect(&vali, SIGNAL(validated(QByteArray,QByteArray)), this, SLOT(slotDownValidated()));
+        connect(&vali, SIGNAL(validationFailed(QString)), this, SLOT(slotDownError(QString)));
+
+        QMap<QByteArray, QByteArray> known;
+        known[checkSumSHA1C] = "abc123";
+
+        // The known value is used as is, the (unrelated) file is not read
+        _successDown = false;
+        vali.start(_testfile, "SHA1:abc123", known);
+        QVERIFY(_successDown);
+
+        _expectedError = QLatin1String("The downloaded file does not match the checksum, it will be resumed.");
+        _errorSeen = false;
+        vali.start(_testfile, "SHA1:def456", known);
+        QVERIFY(_errorSeen);
+
+        // Types without a known value fall back to reading the file
+        _successDown = false;
+        vali.start(_testfile, QByteArray(checkSumMD5C) + ":" + FileSystem::calcMd5(_testfile), known);
+        QTRY_VERIFY(_successDown);
+    }
+
+    void testManyComputationsAtOnce() {
+        // More requests than checksum threads, most of them tiny
+        const int count = 50;
+        QVector<QByteArray> expected;
+        QVector<QByteArray> results(count);
+        int finished = 0;
+        for (int i = 0; i < count; ++i) {
+            const QString file = _root + "/many" + QString::number(i);
+            QFile f(file);
+            QVERIFY(f.open(QIODevice::WriteOnly));
+            f.write(QByteArray(i * 97, char('a' + i % 26)));
+            f.close();
+            expected.append(FileSystem::calcSha1(file));
+
+            auto compute = new ComputeChecksum(this);
+            compute->setChecksumType(checkSumSHA1C);
+            connect(compute, &ComputeChecksum::done, this, [&, i, compute](const QByteArray &type, const QByteArray &checksum) {
+                QCOMPARE(type, QByteArray(checkSumSHA1C));
+                results[i] = checksum;
+                ++finished;
+                compute->deleteLater();
+            });
+            compute->start(file);
+        }
+
+        // Deleting one before it finished must not disturb the others
+        auto abandoned = new ComputeChecksum(this);
+        abandoned->setChecksumType(checkSumSHA1C);
+        abandoned->start(_testfile);
+        delete abandoned;
+
+        QTRY_COMPARE(finished, count);
+        QCOMPARE(results, expected);
+    }
+
     void cleanupTestCase() {
     }
 };
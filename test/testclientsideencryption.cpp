@@ -0,0 +1,150 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "clientsideencryption.h"
+
+using namespace OCC;
+
+class TestClientSideEncryption : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    const QByteArray _key = EncryptionHelper::generateRandom(16);
+    const QByteArray _iv = EncryptionHelper::generateRandom(16);
+
+    QString path(const QString &name) const { return _dir.path() + QLatin1Char('/') + name; }
+
+    static void writeFile(const QString &fileName, const QByteArray &data)
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QCOMPARE(file.write(data), qint64(data.size()));
+    }
+
+    static QByteArray readFile(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            return QByteArray();
+        return file.readAll();
+    }
+
+    bool encrypt(const QString &input, const QString &output, QByteArray &tag)
+    {
+        QFile in(input);
+        QFile out(output);
+        return EncryptionHelper::fileEncryption(_key, _iv, &in, &out, tag);
+    }
+
+    bool decrypt(const QString &input, const QString &output)
+    {
+        QFile in(input);
+        QFile out(output);
+        return EncryptionHelper::fileDecryption(_key, _iv, &in, &out);
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+    }
+
+    void testRoundTrip_data()
+    {
+        QTest::addColumn<int>("size");
+
+        QTest::newRow("empty") << 0;
+        QTest::newRow("small") << 100;
+        QTest::newRow("one block") << 1024 * 1024;
+        QTest::newRow("several blocks") << 2 * 1024 * 1024 + 12345;
+    }
+
+    void testRoundTrip()
+    {
+        QFETCH(int, size);
+        const QByteArray plain = EncryptionHelper::generateRandom(size);
+        writeFile(path("plain"), plain);
+
+        QByteArray tag;
+        QVERIFY(encrypt(path("plain"), path("encrypted"), tag));
+        QCOMPARE(tag.size(), 16);
+        const QByteArray encrypted = readFile(path("encrypted"));
+        // The output is the ciphertext, as long as the input, followed by the tag
+        QCOMPARE(encrypted.size(), size + 16);
+        QCOMPARE(encrypted.right(16), tag);
+        if (size > 0)
+            QVERIFY(encrypted.left(size) != plain);
+
+        QVERIFY(decrypt(path("encrypted"), path("decrypted")));
+        QCOMPARE(readFile(path("decrypted")), plain);
+    }
+
+    void testTamperedInput()
+    {
+        const QByteArray plain = EncryptionHelper::generateRandom(2 * 1024 * 1024 + 1);
+        writeFile(path("plain"), plain);
+        QByteArray tag;
+        QVERIFY(encrypt(path("plain"), path("encrypted"), tag));
+        const QByteArray encrypted = readFile(path("encrypted"));
+
+        // A modified tag
+        QByteArray tampered = encrypted;
+        tampered[tampered.size() - 1] = tampered.at(tampered.size() - 1) ^ 1;
+        writeFile(path("tampered"), tampered);
+        QVERIFY(!decrypt(path("tampered"), path("decrypted")));
+
+        // A modified byte in the second block
+        tampered = encrypted;
+        tampered[1024 * 1024 + 10] = tampered.at(1024 * 1024 + 10) ^ 1;
+        writeFile(path("tampered"), tampered);
+        QVERIFY(!decrypt(path("tampered"), path("decrypted")));
+
+        // Truncated input
+        writeFile(path("tampered"), encrypted.left(encrypted.size() - 1));
+        QVERIFY(!decrypt(path("tampered"), path("decrypted")));
+        writeFile(path("tampered"), encrypted.left(1024 * 1024));
+        QVERIFY(!decrypt(path("tampered"), path("decrypted")));
+
+        // Shorter than a tag
+        writeFile(path("tampered"), encrypted.left(10));
+        QVERIFY(!decrypt(path("tampered"), path("decrypted")));
+    }
+
+    void testFileEncryptionJob()
+    {
+        const QByteArray plain = EncryptionHelper::generateRandom(3 * 1024 * 1024);
+        writeFile(path("plain"), plain);
+
+        FileEncryptionJob encryptJob(FileEncryptionJob::Encrypt, _key, _iv, path("plain"), path("encrypted"));
+        QSignalSpy encrypted(&encryptJob, &FileEncryptionJob::finished);
+        encryptJob.start();
+        QVERIFY(encrypted.wait());
+        QCOMPARE(encrypted[0][0].toBool(), true);
+        QCOMPARE(encryptJob.tag(), readFile(path("encrypted")).right(16));
+
+        FileEncryptionJob decryptJob(FileEncryptionJob::Decrypt, _key, _iv, path("encrypted"), path("decrypted"));
+        QSignalSpy decrypted(&decryptJob, &FileEncryptionJob::finished);
+        decryptJob.start();
+        QVERIFY(decrypted.wait());
+        QCOMPARE(decrypted[0][0].toBool(), true);
+        QCOMPARE(readFile(path("decrypted")), plain);
+
+        // Failures are reported too
+        FileEncryptionJob failingJob(FileEncryptionJob::Decrypt, _key, _iv, path("missing"), path("decrypted"));
+        QSignalSpy failed(&failingJob, &FileEncryptionJob::finished);
+        failingJob.start();
+        QVERIFY(failed.wait());
+        QCOMPARE(failed[0][0].toBool(), false);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestClientSideEncryption)
+#include "testclientsideencryption.moc"
@@ -0,0 +1,129 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#include <QtTest>
+
+#include "concurrencycontroller.h"
+
+using namespace OCC;
+
+class TestConcurrencyController : public QObject
+{
+    Q_OBJECT
+
+    qint64 _now = 0;
+
+    // Finishes a window of jobs that together moved bytesPerSecond
+    void runWindow(ConcurrencyController &controller, ConcurrencyController::JobClass jobClass,
+        qint64 bytesPerSecond, qint64 durationMsecs = 100)
+    {
+        const int jobs = qMax(4, controller.limit(jobClass));
+        const qint64 windowBytes = bytesPerSecond * ConcurrencyController::windowMsecs / 1000;
+        for (int i = 0; i < jobs; ++i) {
+            // The last job closes the window
+            if (i == jobs - 1)
+                _now += ConcurrencyController::windowMsecs;
+            controller.jobFinished(jobClass, windowBytes / jobs, durationMsecs, false);
+        }
+    }
+
+    ConcurrencyController makeController()
+    {
+        _now = 0;
+        ConcurrencyController controller;
+        controller.setClock([this] { return _now; });
+        controller.setLimits(ConcurrencyController::Transfer, 1, 3, 6);
+        controller.setLimits(ConcurrencyController::Quick, 1, 6, 6);
+        return controller;
+    }
+
+private slots:
+    void testGrowsWhileThroughputGrows()
+    {
+        auto controller = makeController();
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 3);
+
+        runWindow(controller, ConcurrencyController::Transfer, 1000000);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 4);
+        runWindow(controller, ConcurrencyController::Transfer, 2000000);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 5);
+
+        // The link is saturated: keep the limit
+        runWindow(controller, ConcurrencyController::Transfer, 2000000);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 5);
+
+        // Never beyond the maximum
+        runWindow(controller, ConcurrencyController::Transfer, 4000000);
+        runWindow(controller, ConcurrencyController::Transfer, 8000000);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 6);
+
+        // Throughput collapsed
+        runWindow(controller, ConcurrencyController::Transfer, 1000000);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 5);
+
+        // The other class is independent
+        QCOMPARE(controller.limit(ConcurrencyController::Quick), 6);
+    }
+
+    void testBytesCountWhileTransferring()
+    {
+        auto controller = makeController();
+
+        controller.bytesTransferred(ConcurrencyController::Transfer, 2000000);
+        runWindow(controller, ConcurrencyController::Transfer, 0);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 4);
+
+        // The same rate, with one large file completing in this window: only
+        // its last bytes are credited when it finishes
+        controller.bytesTransferred(ConcurrencyController::Transfer, 1900000);
+        controller.jobFinished(ConcurrencyController::Transfer, 100000, 1000, false);
+        runWindow(controller, ConcurrencyController::Transfer, 0);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 4);
+
+        // And again without any file completing
+        controller.bytesTransferred(ConcurrencyController::Transfer, 2000000);
+        runWindow(controller, ConcurrencyController::Transfer, 0);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 4);
+    }
+
+    void testOverloadHalves()
+    {
+        auto controller = makeController();
+        controller.setLimits(ConcurrencyController::Transfer, 1, 6, 6);
+
+        // Several jobs failing together only halve once
+        controller.jobFinished(ConcurrencyController::Transfer, 0, 100, true);
+        controller.jobFinished(ConcurrencyController::Transfer, 0, 100, true);
+        controller.jobFinished(ConcurrencyController::Transfer, 0, 100, true);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 3);
+
+        // No increase in the window that saw the overload
+        _now += ConcurrencyController::windowMsecs;
+        controller.jobFinished(ConcurrencyController::Transfer, 1000, 100, false);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 3);
+
+        // A new window may halve again, but not below the minimum
+        controller.jobFinished(ConcurrencyController::Transfer, 0, 100, true);
+        QCOMPARE(controller.limit(ConcurrencyController::Transfer), 1);
+        QVERIFY(controller.status().contains("transfer: limit 1"));
+    }
+
+    void testQuickJobsBackOffWhenSlow()
+    {
+        auto controller = makeController();
+        controller.setLimits(ConcurrencyController::Quick, 1, 4, 6);
+
+        runWindow(controller, ConcurrencyController::Quick, 0, 50);
+        QCOMPARE(controller.limit(ConcurrencyController::Quick), 5);
+
+        // Requests take much longer than before: they queue on the server
+        runWindow(controller, ConcurrencyController::Quick, 0, 500);
+        QCOMPARE(controller.limit(ConcurrencyController::Quick), 4);
+    }
+};
+
+QTEST_APPLESS_MAIN(TestConcurrencyController)
+#include "testconcurrencycontroller.moc"
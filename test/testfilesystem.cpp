@@ -70,6 +70,22 @@ private slots:
         QCOMPARE(sSum, sum);
     }
 
+    void testPreallocate()
+    {
+        QFile file(_root.path() + "/file_c.bin");
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QCOMPARE(file.write("0123456789"), 10LL);
+
+        // Whether space is reserved depends on the file system, but the
+        // data and the size must stay the same
+        preallocate(file, 1024 * 1024);
+        QCOMPARE(file.write("abc"), 3LL);
+        file.close();
+        QCOMPARE(getSize(file.fileName()), 13LL);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), QByteArray("0123456789abc"));
+    }
+
 };
 
 QTEST_APPLESS_MAIN(TestFileSystem)
@@ -187,6 +187,96 @@ private slots:
         QCOMPARE(folderman->findGoodPathForNewSyncFolder(dirPath + "/ownCloud2", url),
             QString(dirPath + "/ownCloud22"));
     }
+
+    void testSyncScheduling()
+    {
+        QTemporaryDir dir;
+        ConfigFile::setConfDir(dir.path()); // we don't want to pollute the user's config file
+        QVERIFY(dir.isValid());
+        QDir dir2(dir.path());
+        QString dirPath = dir2.canonicalPath();
+
+        auto connectedAccount = [](const QString &url) {
+            AccountPtr account = Account::create();
+            account->setCredentials(new HttpCredentialsTest("testuser", "secret"));
+            account->setUrl(QUrl(url));
+            AccountStatePtr accountState(new AccountState(account));
+            QMetaObject::invokeMethod(accountState.data(), "slotConnectionValidatorResult", Qt::DirectConnection,
+                Q_ARG(ConnectionValidator::Status, ConnectionValidator::Connected),
+                Q_ARG(QStringList, QStringList()));
+            return accountState;
+        };
+        AccountStatePtr accountA = connectedAccount("http://a.example.de");
+        AccountStatePtr accountB = connectedAccount("http://b.example.de");
+        QVERIFY(accountA->isConnected());
+        QVERIFY(accountB->isConnected());
+
+        auto addFolder = [&](const AccountStatePtr &accountState, const QString &name) {
+            dir2.mkpath(name);
+            return _fm.addFolder(accountState.data(), folderDefinition(dirPath + "/" + name));
+        };
+        Folder *a1 = addFolder(accountA, "a1");
+        Folder *a2 = addFolder(accountA, "a2");
+        Folder *a3 = addFolder(accountA, "a3");
+        Folder *a4 = addFolder(accountA, "a4");
+        Folder *b1 = addFolder(accountB, "b1");
+        Folder *b2 = addFolder(accountB, "b2");
+        QVERIFY(a1 && a2 && a3 && a4 && b1 && b2);
+        _fm._scheduledFolders.clear();
+        _fm._backgroundScheduledFolders.clear();
+        auto scheduleQueue = [&] { return QList<Folder *>(_fm.scheduleQueue()); };
+
+        // Normal syncs are queued ahead of the background ones
+        _fm.scheduleFolder(a1, FolderMan::SyncPriority::Background);
+        _fm.scheduleFolder(a2, FolderMan::SyncPriority::Normal);
+        _fm.scheduleFolder(a3, FolderMan::SyncPriority::Background);
+        _fm.scheduleFolder(a4, FolderMan::SyncPriority::Normal);
+        QCOMPARE(scheduleQueue(), QList<Folder *>() << a2 << a4 << a1 << a3);
+
+        // Scheduling a queued background folder with normal priority raises it,
+        // but a normal one is never lowered
+        _fm.scheduleFolder(a3, FolderMan::SyncPriority::Normal);
+        QCOMPARE(scheduleQueue(), QList<Folder *>() << a2 << a4 << a3 << a1);
+        _fm.scheduleFolder(a2, FolderMan::SyncPriority::Background);
+        QCOMPARE(scheduleQueue(), QList<Folder *>() << a2 << a4 << a3 << a1);
+
+        // Without running syncs, the queue order decides
+        QCOMPARE(_fm.takeNextScheduledFolder(), a2);
+        _fm._currentSyncFolders.append(a2);
+
+        // Folders of accounts with fewer running syncs go first...
+        _fm.scheduleFolder(b1, FolderMan::SyncPriority::Normal);
+        QCOMPARE(scheduleQueue(), QList<Folder *>() << a4 << a3 << b1 << a1);
+        QCOMPARE(_fm.takeNextScheduledFolder(), b1);
+
+        // ...but background syncs don't overtake normal ones
+        _fm.scheduleFolder(b2, FolderMan::SyncPriority::Background);
+        QCOMPARE(scheduleQueue(), QList<Folder *>() << a4 << a3 << a1 << b2);
+        QCOMPARE(_fm.takeNextScheduledFolder(), a4);
+        _fm._currentSyncFolders.append(a4);
+
+        // A folder that is scheduled again while syncing waits for that sync
+        _fm.scheduleFolder(a2, FolderMan::SyncPriority::Normal);
+        QCOMPARE(scheduleQueue(), QList<Folder *>() << a3 << a2 << a1 << b2);
+        QCOMPARE(_fm.takeNextScheduledFolder(), a3);
+
+        // No sync starts while the maximum number of folders are syncing
+        QList<Folder *> running;
+        for (int i = 0; i < FolderMan::maximumConcurrentSyncs(); ++i) {
+            Folder *f = addFolder(accountB, QStringLiteral("running%1").arg(i));
+            QVERIFY(f);
+            running.append(f);
+        }
+        _fm._currentSyncFolders = running;
+        const auto queued = scheduleQueue();
+        _fm.slotStartScheduledFolderSync();
+        QCOMPARE(scheduleQueue(), queued);
+        QCOMPARE(_fm.currentSyncFolders(), running);
+
+        _fm._currentSyncFolders.clear();
+        _fm._scheduledFolders.clear();
+        _fm._backgroundScheduledFolders.clear();
+    }
 };
 
 QTEST_APPLESS_MAIN(TestFolderMan)
@@ -8,6 +8,8 @@
 #include <QtTest>
 #include "syncenginetestutils.h"
 #include <syncengine.h>
+#include <networkjobs.h>
+#include <owncloudpropagator.h>
 
 using namespace OCC;
 
@@ -631,6 +633,30 @@ private slots:
         QVERIFY(!engine.shouldDiscoverLocally("foo bar"));
         QVERIFY(!engine.shouldDiscoverLocally("foo bar/touch"));
 
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(
+            LocalDiscoveryStyle::DatabaseAndFilesystem,
+            { "A/X" }, { "B/Y" });
+
+        QVERIFY(engine.shouldDiscoverLocally(""));
+        QVERIFY(engine.shouldDiscoverLocally("A/X"));
+        QVERIFY(!engine.shouldDiscoverLocally("A/X/Y"));
+        QVERIFY(engine.shouldDiscoverLocally("B"));
+        QVERIFY(engine.shouldDiscoverLocally("B/Y"));
+        QVERIFY(engine.shouldDiscoverLocally("B/Y/Z"));
+        QVERIFY(engine.shouldDiscoverLocally("B/Y/Z/W"));
+        QVERIFY(!engine.shouldDiscoverLocally("B/Y Z"));
+        QVERIFY(!engine.shouldDiscoverLocally("B/X"));
+
+        // The root itself is not watched: everything is scanned
+        fakeFolder.syncEngine().setLocalDiscoveryOptions(
+            LocalDiscoveryStyle::DatabaseAndFilesystem,
+            { "A/X" }, { "" });
+
+        QVERIFY(engine.shouldDiscoverLocally(""));
+        QVERIFY(engine.shouldDiscoverLocally("A/X"));
+        QVERIFY(engine.shouldDiscoverLocally("B"));
+        QVERIFY(engine.shouldDiscoverLocally("C/Z/W"));
+
         fakeFolder.syncEngine().setLocalDiscoveryOptions(
             LocalDiscoveryStyle::DatabaseAndFilesystem,
             {});
@@ -715,6 +741,243 @@ private slots:
         QTextCodec::setCodecForLocale(utf8Locale);
 #endif
     }
+
+    // Changed remote directories are listed in parallel, unchanged ones are read from the db
+    void testParallelRemoteDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.remoteModifier().appendByte("B/b1");
+        fakeFolder.remoteModifier().appendByte("C/c1");
+        fakeFolder.remoteModifier().mkdir("D");
+        fakeFolder.remoteModifier().insert("D/d1");
+
+        QStringList listedPaths;
+        int inFlight = 0;
+        int maxInFlight = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) != "PROPFIND")
+                return nullptr;
+            listedPaths.append(getFilePathFromUrl(request.url()));
+            auto reply = new FakePropfindReply(fakeFolder.remoteModifier(), op, request, this);
+            maxInFlight = qMax(maxInFlight, ++inFlight);
+            connect(reply, &QNetworkReply::finished, [&inFlight] { --inFlight; });
+            return reply;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        listedPaths.sort();
+        QCOMPARE(listedPaths, QStringList({ "", "A", "B", "C", "D" }));
+        QVERIFY(maxInFlight > 1);
+    }
+
+    // The first sync can list the whole remote tree with one request
+    void testBulkInitialDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions options;
+        options._bulkInitialDiscovery = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        fakeFolder.remoteModifier().mkdir("A/Sub");
+        fakeFolder.remoteModifier().insert("A/Sub/file");
+        fakeFolder.remoteModifier().mkdir("A/Sub/Empty");
+        // Start over as if it was the first sync
+        fakeFolder.syncJournal().clearFileTable();
+
+        QList<QByteArray> depths;
+        bool refuseInfiniteDepth = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) != "PROPFIND")
+                return nullptr;
+            depths.append(request.rawHeader("Depth"));
+            if (refuseInfiniteDepth && request.rawHeader("Depth") == "infinity")
+                return new FakeErrorReply(op, request, this, 403);
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(depths, QList<QByteArray>({ "infinity" }));
+
+        // Only the first sync lists everything
+        depths.clear();
+        fakeFolder.remoteModifier().insert("B/b3");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!depths.contains("infinity"));
+
+        // Fall back to listing each directory if the server refuses
+        depths.clear();
+        refuseInfiniteDepth = true;
+        fakeFolder.syncJournal().clearFileTable();
+        fakeFolder.remoteModifier().insert("A/Sub/file2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(depths.first(), QByteArray("infinity"));
+        QCOMPARE(depths.count("1"), 7); // root, A, A/Sub, A/Sub/Empty, B, C, S
+    }
+
+    // Big downloads are split into ranges if the server supports them
+    void testRangedDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QObject parent;
+
+        bool honorRange = true;
+        QList<QByteArray> ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation) {
+                ranges.append(request.rawHeader("Range"));
+                auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, &parent);
+                reply->honorRange = honorRange;
+                return reply;
+            }
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().insert("A/big", 60 * 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges, QList<QByteArray>({ "bytes=0-29999999", "bytes=30000000-59999999" }));
+        QCOMPARE(fakeFolder.syncJournal().downloadInfoCount(), 0);
+
+        // The whole file is accepted if the server ignores the range
+        ranges.clear();
+        honorRange = false;
+        fakeFolder.remoteModifier().insert("A/big2", 60 * 1000 * 1000);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(ranges.size(), 1);
+        QCOMPARE(fakeFolder.syncJournal().downloadInfoCount(), 0);
+    }
+
+    void testConcurrentSyncsShareJobBudget()
+    {
+        FakeFolder fakeFolderA{ FileInfo{} };
+        FakeFolder fakeFolderB{ FileInfo{} };
+        const int budget = OwncloudPropagator::hardMaximumActiveJob(fakeFolderA.syncEngine().account(), SyncOptions());
+
+        QObject parent;
+        int runningGets = 0;
+        int maxRunningGets = 0;
+        auto countGets = [&](FakeFolder *fakeFolder) {
+            return [&, fakeFolder](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+                if (op != QNetworkAccessManager::GetOperation)
+                    return nullptr;
+                auto reply = new DelayedReply<FakeGetReply>(20, fakeFolder->remoteModifier(), op, request, &parent);
+                maxRunningGets = qMax(maxRunningGets, ++runningGets);
+                QObject::connect(reply, &QNetworkReply::finished, [&] { --runningGets; });
+                return reply;
+            };
+        };
+        fakeFolderA.setServerOverride(countGets(&fakeFolderA));
+        fakeFolderB.setServerOverride(countGets(&fakeFolderB));
+        for (int i = 0; i < 3 * budget; ++i) {
+            fakeFolderA.remoteModifier().insert(QStringLiteral("a%1").arg(i));
+            fakeFolderB.remoteModifier().insert(QStringLiteral("b%1").arg(i));
+        }
+
+        // Both syncs finish, and together they never exceed the budget
+        QSignalSpy finishedA(&fakeFolderA.syncEngine(), SIGNAL(finished(bool)));
+        QSignalSpy finishedB(&fakeFolderB.syncEngine(), SIGNAL(finished(bool)));
+        fakeFolderA.scheduleSync();
+        fakeFolderB.scheduleSync();
+        QTRY_VERIFY_WITH_TIMEOUT(finishedA.count() == 1 && finishedB.count() == 1, 20000);
+        QVERIFY(finishedA[0][0].toBool());
+        QVERIFY(finishedB[0][0].toBool());
+        QCOMPARE(fakeFolderA.currentLocalState(), fakeFolderA.currentRemoteState());
+        QCOMPARE(fakeFolderB.currentLocalState(), fakeFolderB.currentRemoteState());
+        QVERIFY(maxRunningGets > 0);
+        QVERIFY(maxRunningGets <= budget);
+    }
+
+    void testLearnedConcurrencyCarriesOver()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        auto account = fakeFolder.syncEngine().account();
+
+        // A sync records where its parallelism ended up
+        QCOMPARE(account->learnedConcurrency(ConcurrencyController::Transfer), 0);
+        fakeFolder.remoteModifier().insert("first");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(account->learnedConcurrency(ConcurrencyController::Transfer) > 0);
+        QVERIFY(account->learnedConcurrency(ConcurrencyController::Quick) > 0);
+
+        // The next sync starts from the recorded limits
+        account->setLearnedConcurrency(ConcurrencyController::Transfer, 1);
+        account->setLearnedConcurrency(ConcurrencyController::Quick, 1);
+
+        QObject parent;
+        int runningGets = 0;
+        int maxRunningGets = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            auto reply = new DelayedReply<FakeGetReply>(20, fakeFolder.remoteModifier(), op, request, &parent);
+            maxRunningGets = qMax(maxRunningGets, ++runningGets);
+            QObject::connect(reply, &QNetworkReply::finished, [&] { --runningGets; });
+            return reply;
+        });
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("f%1").arg(i));
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        // One transfer plus one quick job
+        QVERIFY(maxRunningGets > 0);
+        QVERIFY(maxRunningGets <= 2);
+        // Too short to measure a window, so the limits stay where they started
+        QCOMPARE(account->learnedConcurrency(ConcurrencyController::Transfer), 1);
+        QCOMPARE(account->learnedConcurrency(ConcurrencyController::Quick), 1);
+    }
+
+    void testEtagBatchJob()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().mkdir("A/A");
+        fakeFolder.remoteModifier().mkdir("A/x");
+        QMap<QString, QString> etags;
+        QStringList notListed;
+        auto runJob = [&](const QString &path, const QStringList &folderPaths) {
+            etags.clear();
+            notListed.clear();
+            auto job = new EtagBatchJob(fakeFolder.syncEngine().account(), path, folderPaths);
+            QObject::connect(job, &EtagBatchJob::etagRetrieved, [&](const QString &folderPath, const QString &etag) {
+                etags.insert(folderPath, etag);
+            });
+            QObject::connect(job, &EtagBatchJob::folderNotListed, [&](const QString &folderPath) {
+                notListed.append(folderPath);
+            });
+            QSignalSpy destroyedSpy(job, &QObject::destroyed);
+            job->start();
+            QVERIFY(destroyedSpy.wait());
+        };
+
+        // A folder with the name of the listed directory isn't confused with it,
+        // folders missing from the listing are reported
+        runJob("A", { "/A/A/", "/A/x/", "/A/Moved/" });
+        QCOMPARE(etags.size(), 2);
+        QCOMPARE(etags["/A/A/"], fakeFolder.currentRemoteState().find("A/A")->etag);
+        QCOMPARE(etags["/A/x/"], fakeFolder.currentRemoteState().find("A/x")->etag);
+        QCOMPARE(notListed, QStringList({ "/A/Moved/" }));
+
+        // Every folder is reported if the listing fails
+        // The root folder is checked with its children
+        runJob("/", { "/", "/A/", "/B/" });
+        QCOMPARE(etags.size(), 3);
+        QCOMPARE(etags["/"], fakeFolder.currentRemoteState().etag);
+        QCOMPARE(etags["/A/"], fakeFolder.currentRemoteState().find("A")->etag);
+        QCOMPARE(etags["/B/"], fakeFolder.currentRemoteState().find("B")->etag);
+        QVERIFY(notListed.isEmpty());
+
+        // Every folder is reported if the listing fails
+        fakeFolder.serverErrorPaths().append("A", 403);
+        runJob("A", { "/A/", "/A/A/", "/A/x/", "/A/Moved/" });
+        QVERIFY(etags.isEmpty());
+        notListed.sort();
+        QCOMPARE(notListed, QStringList({ "/A/", "/A/A/", "/A/Moved/", "/A/x/" }));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
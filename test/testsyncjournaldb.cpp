@@ -143,6 +143,11 @@ private slots:
         Info storedRecord = _db.getDownloadInfo("foo");
         QVERIFY(storedRecord == record);
 
+        record._ranges = { { 1000, 5000 }, { 5000, 5000 }, { 9000, 12000 } };
+        _db.setDownloadInfo("foo", record);
+        storedRecord = _db.getDownloadInfo("foo");
+        QVERIFY(storedRecord == record);
+
         _db.setDownloadInfo("foo", Info());
         Info wipedRecord = _db.getDownloadInfo("foo");
         QVERIFY(!wipedRecord._valid);
@@ -320,6 +325,130 @@ private slots:
         QVERIFY(checkElements());
     }
 
+    void testReadConnection()
+    {
+        SyncJournalFileRecord record;
+        record._path = "readconn";
+        record._inode = 4242;
+        record._fileId = "readconnid";
+        QVERIFY(_db.setFileRecord(record));
+
+        // The pending write is committed when the read connection is opened
+        QVERIFY(_db.openReadConnectionForCurrentThread());
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("readconn"), &storedRecord));
+        QVERIFY(storedRecord == record);
+        QVERIFY(_db.getFileRecordByInode(4242, &storedRecord));
+        QVERIFY(storedRecord == record);
+        int count = 0;
+        QVERIFY(_db.getFileRecordsByFileId("readconnid", [&](const SyncJournalFileRecord &) { ++count; }));
+        QCOMPARE(count, 1);
+
+        // Uncommitted writes of the main connection are not visible to the reader
+        record._path = "readconn2";
+        record._inode = 4243;
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("readconn2"), &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+        _db.commit("test");
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("readconn2"), &storedRecord));
+        QVERIFY(storedRecord == record);
+
+        // Once released, lookups go through the main connection again
+        _db.releaseReadConnection();
+        QVERIFY(_db.deleteFileRecord("readconn2"));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("readconn2"), &storedRecord));
+        QVERIFY(!storedRecord.isValid());
+        QVERIFY(_db.deleteFileRecord("readconn"));
+    }
+
+    void testMetadataSnapshot()
+    {
+        auto makeEntry = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._etag = "etag";
+            QVERIFY(_db.setFileRecord(record));
+        };
+        makeEntry("snap");
+        makeEntry("snap/a");
+        makeEntry("snap/b");
+
+        QVERIFY(_db.loadMetadataSnapshot());
+
+        SyncJournalFileRecord record;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/a"), &record));
+        QVERIFY(record.isValid());
+        QCOMPARE(record._etag, QByteArray("etag"));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/c"), &record));
+        QVERIFY(!record.isValid());
+
+        // Writes go through to the snapshot
+        makeEntry("snap/c");
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/c"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(_db.updateLocalMetadata("snap/c", 42, 43, 44));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/c"), &record));
+        QCOMPARE(record._modtime, qint64(42));
+        QCOMPARE(record._fileSize, qint64(43));
+        QCOMPARE(record._inode, quint64(44));
+        QVERIFY(_db.updateFileRecordChecksum("snap/c", "abc", "MD5"));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/c"), &record));
+        QCOMPARE(record._checksumHeader, QByteArray("MD5:abc"));
+
+        QVERIFY(_db.deleteFileRecord("snap", true));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/b"), &record));
+        QVERIFY(!record.isValid());
+
+        // After dropping it, the database has the same content
+        makeEntry("snap/d");
+        _db.dropMetadataSnapshot();
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/d"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/a"), &record));
+        QVERIFY(!record.isValid());
+        QVERIFY(_db.deleteFileRecord("snap", true));
+    }
+
+    void testManyFileRecords()
+    {
+        const int countBefore = _db.getFileRecordCount();
+
+        // Alternating checksum types go through the checksum type id cache
+        const int count = 537;
+        for (int i = 0; i < count; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "batch/" + QByteArray::number(i);
+            record._inode = 10000 + i;
+            record._etag = "first";
+            record._checksumHeader = (i % 2) ? "SHA1:" + QByteArray::number(i) : QByteArray();
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        // A second write to the same path replaces the first one
+        SyncJournalFileRecord record;
+        record._path = "batch/536";
+        record._inode = 10536;
+        record._etag = "second";
+        QVERIFY(_db.setFileRecord(record));
+
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("batch/536"), &storedRecord));
+        QCOMPARE(storedRecord._etag, QByteArray("second"));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("batch/1"), &storedRecord));
+        QCOMPARE(storedRecord._checksumHeader, QByteArray("SHA1:1"));
+        QVERIFY(_db.getFileRecordByInode(10100, &storedRecord));
+        QCOMPARE(storedRecord._path, QByteArray("batch/100"));
+        QCOMPARE(_db.getFileRecordCount(), countBefore + count);
+
+        // Records written before a commit show up in recursive deletes
+        record._path = "batch/extra";
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("test");
+        QVERIFY(_db.deleteFileRecord("batch", true));
+        QCOMPARE(_db.getFileRecordCount(), countBefore);
+    }
+
 private:
     SyncJournalDb _db;
 };
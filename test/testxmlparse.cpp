@@ -473,6 +473,80 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    void testParserIncremental() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<oc:size>121780</oc:size>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+
+        QList<QMap<QString, QString>> properties;
+        connect(&parser, &LsColXMLParser::directoryListingIterated, this,
+            [&](const QString &item, const QMap<QString, QString> &map) {
+                _items.append(item);
+                properties.append(map);
+            });
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        // Feed the reply in small chunks that split elements and texts
+        QHash <QString, ExtraFolderInfo> sizes;
+        parser.start(&sizes, "/oc/remote.php/webdav/sharefolder");
+        for (int i = 0; i < testXml.size(); i += 7) {
+            QVERIFY(parser.addData(testXml.mid(i, 7)));
+            if (i + 7 <= testXml.indexOf("</d:response>")) {
+                QVERIFY(_items.isEmpty());
+            }
+        }
+        QVERIFY(!_success);
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+
+        QCOMPARE(_items, QStringList({ "/oc/remote.php/webdav/sharefolder", "/oc/remote.php/webdav/sharefolder/quitte.pdf" }));
+        QCOMPARE(properties[0].value("resourcetype"), QString("<collection></collection>"));
+        QCOMPARE(properties[0].value("getetag"), QString("\"5527beb0400b0\""));
+        QCOMPARE(properties[1].value("getcontentlength"), QString("121780"));
+        QCOMPARE(sizes.value("/oc/remote.php/webdav/sharefolder/").size, qint64(121780));
+        QCOMPARE(_subdirs, QStringList("/oc/remote.php/webdav/sharefolder/"));
+    }
+
+    void testParserIncrementalBrokenXml() {
+        LsColXMLParser parser;
+        QHash <QString, ExtraFolderInfo> sizes;
+        parser.start(&sizes, "/oc/remote.php/webdav/sharefolder");
+        QVERIFY(parser.addData("<?xml version='1.0' encoding='utf-8'?><d:multistatus xmlns:d=\"DAV:\">"));
+        QVERIFY(!parser.addData("<d:response></d:multistatus>"));
+        QVERIFY(!parser.finish());
+    }
+
 };
 
     QTEST_GUILESS_MAIN(TestXmlParse)